@@ -0,0 +1,199 @@
+// Count the heap allocations made by time steps after the first one.  The
+// program is built when yamss is configured with YAMSS_COUNT_ALLOCATIONS=ON:
+//
+//   yamss-allocations INPUT [STEPS]
+//
+// The first step may size workspaces; every later step should reuse them.
+// The program reports the number of allocations made by the later steps and
+// exits with a nonzero status if there were any.  Inspectors named in the
+// input file are left out, since writing output allocates by nature.
+//
+// Allocations are counted in the replacement operator new and, where the C
+// library is glibc, in malloc and its relatives as well, so that memory
+// Armadillo acquires for temporaries is counted too.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <string>
+#include <boost/make_shared.hpp>
+#include "yamss/input_reader.hpp"
+#include "yamss/runner.hpp"
+
+namespace {
+
+std::atomic<std::size_t> g_allocations(0);
+std::atomic<bool> g_counting(false);
+
+void
+count_allocation()
+{
+  if (g_counting.load(std::memory_order_relaxed))
+  {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void*
+allocate(std::size_t a_size)
+{
+#ifndef __GLIBC__
+  count_allocation();
+#endif
+  return std::malloc(a_size == 0 ? 1 : a_size);
+}
+
+} // anonymous namespace
+
+#ifdef __GLIBC__
+extern "C" {
+
+void* __libc_malloc(std::size_t a_size);
+void* __libc_calloc(std::size_t a_count, std::size_t a_size);
+void* __libc_realloc(void* a_pointer, std::size_t a_size);
+void* __libc_memalign(std::size_t a_alignment, std::size_t a_size);
+void __libc_free(void* a_pointer);
+
+void*
+malloc(std::size_t a_size)
+{
+  count_allocation();
+  return __libc_malloc(a_size);
+}
+
+void*
+calloc(std::size_t a_count, std::size_t a_size)
+{
+  count_allocation();
+  return __libc_calloc(a_count, a_size);
+}
+
+void*
+realloc(void* a_pointer, std::size_t a_size)
+{
+  count_allocation();
+  return __libc_realloc(a_pointer, a_size);
+}
+
+int
+posix_memalign(void** a_pointer, std::size_t a_alignment, std::size_t a_size)
+{
+  count_allocation();
+  *a_pointer = __libc_memalign(a_alignment, a_size);
+  return *a_pointer ? 0 : ENOMEM;
+}
+
+void*
+aligned_alloc(std::size_t a_alignment, std::size_t a_size)
+{
+  count_allocation();
+  return __libc_memalign(a_alignment, a_size);
+}
+
+void
+free(void* a_pointer)
+{
+  __libc_free(a_pointer);
+}
+
+} // extern "C"
+#endif
+
+void*
+operator new(std::size_t a_size)
+{
+  void* pointer = allocate(a_size);
+  if (!pointer)
+  {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void*
+operator new[](std::size_t a_size)
+{
+  return operator new(a_size);
+}
+
+void*
+operator new(std::size_t a_size, const std::nothrow_t&) noexcept
+{
+  return allocate(a_size);
+}
+
+void*
+operator new[](std::size_t a_size, const std::nothrow_t&) noexcept
+{
+  return allocate(a_size);
+}
+
+void
+operator delete(void* a_pointer) noexcept
+{
+  std::free(a_pointer);
+}
+
+void
+operator delete[](void* a_pointer) noexcept
+{
+  std::free(a_pointer);
+}
+
+void
+operator delete(void* a_pointer, std::size_t) noexcept
+{
+  std::free(a_pointer);
+}
+
+void
+operator delete[](void* a_pointer, std::size_t) noexcept
+{
+  std::free(a_pointer);
+}
+
+int
+main(int argc, char* argv[])
+{
+  typedef yamss::runner<double> runner_type;
+
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " INPUT [STEPS]" << std::endl;
+    return 1;
+  }
+  const int n_steps = (argc > 2) ? std::atoi(argv[2]) : 100;
+
+  try
+  {
+    boost::shared_ptr<runner_type> input = yamss::read_input<double>(argv[1]);
+    runner_type runner_(input->get_eom(),
+                        input->get_structure(),
+                        input->get_integrator());
+    runner_.set_time_step(input->get_time_step());
+    runner_.initialize();
+    runner_.step();
+
+    g_counting = true;
+    for (int n = 1; n < n_steps; ++n)
+    {
+      runner_.step();
+    }
+    g_counting = false;
+
+    const std::size_t allocations = g_allocations.load();
+    std::cout << "Steps:       " << n_steps << std::endl;
+    std::cout << "Allocations: " << allocations
+              << " after the first step" << std::endl;
+    return allocations == 0 ? 0 : 1;
+  }
+  catch (std::exception& e)
+  {
+    g_counting = false;
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,104 @@
+// A stand-in for a coupling partner that runs on the same host as the yamss
+// server.  Create and initialize a job as usual, and share it and its
+// interface loads with the share call, for example from Python:
+//
+//   job = yamss.create("file:///path/to/input.xml")
+//   yamss.initialize(job)
+//   yamss.share(job, [1])
+//
+// and then run
+//
+//   yamss-shm-client JOB STEPS PRESSURE LOAD [LOAD ...]
+//
+// The client applies a uniform pressure to each load, steps the job STEPS
+// times through the shared regions, and reports how long the exchanges took
+// and the largest displacement of each load after the last step.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "yamss/server/shared_memory.hpp"
+
+int
+main(int argc, char* argv[])
+{
+  typedef std::chrono::steady_clock clock_type;
+  typedef std::chrono::duration<double, std::micro> microseconds_type;
+
+  if (argc < 5)
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " JOB STEPS PRESSURE LOAD [LOAD ...]" << std::endl;
+    return 1;
+  }
+
+  const std::string job = argv[1];
+  const int n_steps = std::atoi(argv[2]);
+  const double pressure = std::atof(argv[3]);
+  std::vector<std::int64_t> load_keys;
+  for (int n = 4; n < argc; ++n)
+  {
+    load_keys.push_back(std::atoll(argv[n]));
+  }
+
+  try
+  {
+    yamss::server::shared_client client(job, load_keys);
+
+    std::vector<double> latencies;
+    latencies.reserve(n_steps);
+    for (int step = 0; step < n_steps; ++step)
+    {
+      for (size_t n = 0; n < client.get_number_of_loads(); ++n)
+      {
+        double* pressures = client.get_pressures(n);
+        std::fill(pressures, pressures + client.get_number_of_pressures(n),
+                  pressure);
+      }
+
+      const clock_type::time_point start = clock_type::now();
+      client.exchange();
+      latencies.push_back(microseconds_type(clock_type::now() - start).count());
+    }
+
+    if (!latencies.empty())
+    {
+      std::sort(latencies.begin(), latencies.end());
+      double total = 0.0;
+      for (size_t n = 0; n < latencies.size(); ++n)
+      {
+        total += latencies[n];
+      }
+      std::cout << "Exchanges:      " << latencies.size() << std::endl;
+      std::cout << "Minimum (us):   " << latencies.front() << std::endl;
+      std::cout << "Median (us):    " << latencies[latencies.size() / 2]
+                << std::endl;
+      std::cout << "Mean (us):      " << total / latencies.size() << std::endl;
+      std::cout << "Maximum (us):   " << latencies.back() << std::endl;
+    }
+
+    for (size_t n = 0; n < client.get_number_of_loads(); ++n)
+    {
+      const double* displacements = client.get_displacements(n);
+      double largest = 0.0;
+      for (size_t i = 0; i < client.get_number_of_rows(n); ++i)
+      {
+        largest = std::max(largest, std::fabs(displacements[i]));
+      }
+      std::cout << "Load " << load_keys[n] << " displacement: " << largest
+                << std::endl;
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
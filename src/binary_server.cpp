@@ -0,0 +1,459 @@
+#include <cerrno>
+#include <cstring>
+#include <boost/make_shared.hpp>
+#include "yamss/server/binary_server.hpp"
+
+namespace yamss {
+namespace server {
+
+namespace {
+
+// ZeroMQ calls this once it has sent a frame that points into memory owned
+// by someone else; dropping the reference lets that memory go.
+
+void
+release_owner(void* a_data, void* a_hint)
+{
+  delete static_cast<boost::shared_ptr<void>*>(a_hint);
+}
+
+YamssException
+make_exception(const std::string& a_what)
+{
+  YamssException ye;
+  ye.what = a_what;
+  return ye;
+}
+
+} // anonymous namespace
+
+class binary_server::frame
+{
+public:
+  frame()
+  {
+    zmq_msg_init(&m_message);
+  }
+
+  frame(const std::string& a_string)
+  {
+    zmq_msg_init_size(&m_message, a_string.size());
+    std::memcpy(zmq_msg_data(&m_message), a_string.data(), a_string.size());
+  }
+
+  // The frame refers to a_data, which a_owner keeps alive until ZeroMQ is
+  // done with it.  Nothing is copied.
+
+  frame(const void* a_data, size_t a_size, const owner_type& a_owner)
+  {
+    if (a_size == 0)
+    {
+      zmq_msg_init(&m_message);
+      return;
+    }
+    zmq_msg_init_data(&m_message, const_cast<void*>(a_data), a_size,
+                      release_owner, new owner_type(a_owner));
+  }
+
+  ~frame()
+  {
+    zmq_msg_close(&m_message);
+  }
+
+  zmq_msg_t*
+  get()
+  {
+    return &m_message;
+  }
+
+  const void*
+  data() const
+  {
+    return zmq_msg_data(const_cast<zmq_msg_t*>(&m_message));
+  }
+
+  size_t
+  size() const
+  {
+    return zmq_msg_size(const_cast<zmq_msg_t*>(&m_message));
+  }
+
+  std::string
+  str() const
+  {
+    return std::string(static_cast<const char*>(data()), size());
+  }
+private:
+  frame(const frame& a_other);
+
+  frame&
+  operator=(const frame& a_other);
+
+  zmq_msg_t m_message;
+}; // frame class
+
+binary_server::binary_server(void* a_context,
+                             const std::string& a_endpoint,
+                             int a_type,
+                             const boost::shared_ptr<handler>& a_handler)
+  : m_socket(zmq_socket(a_context, a_type))
+  , m_handler(a_handler)
+{
+  if (!m_socket || zmq_bind(m_socket, a_endpoint.c_str()) != 0)
+  {
+    boost::format fmt("Could not bind to %1%");
+    throw std::runtime_error(boost::str(fmt % a_endpoint));
+  }
+}
+
+binary_server::~binary_server()
+{
+  int linger = 0;
+  zmq_setsockopt(m_socket, ZMQ_LINGER, &linger, sizeof(linger));
+  zmq_close(m_socket);
+}
+
+void
+binary_server::serve()
+{
+  frames_type request;
+  frames_type reply;
+  while (receive(request))
+  {
+    reply.clear();
+    try
+    {
+      dispatch(request, reply);
+    }
+    catch (YamssException& e)
+    {
+      reply.clear();
+      reply.push_back(boost::make_shared<frame>("error"));
+      reply.push_back(boost::make_shared<frame>(e.what));
+    }
+    catch (std::exception& e)
+    {
+      reply.clear();
+      reply.push_back(boost::make_shared<frame>("error"));
+      reply.push_back(boost::make_shared<frame>(std::string(e.what())));
+    }
+    if (!send(reply))
+    {
+      break;
+    }
+  }
+}
+
+bool
+binary_server::receive(frames_type& a_frames)
+{
+  a_frames.clear();
+  int more = 1;
+  while (more)
+  {
+    frame_pointer frame_ = boost::make_shared<frame>();
+    while (zmq_msg_recv(frame_->get(), m_socket, 0) < 0)
+    {
+      if (errno != EINTR)
+      {
+        return false;
+      }
+    }
+    more = zmq_msg_more(frame_->get());
+    a_frames.push_back(frame_);
+  }
+  return true;
+}
+
+bool
+binary_server::send(const frames_type& a_frames)
+{
+  for (size_t n = 0; n < a_frames.size(); ++n)
+  {
+    int flags = (n + 1 < a_frames.size()) ? ZMQ_SNDMORE : 0;
+    if (zmq_msg_send(a_frames[n]->get(), m_socket, flags) < 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+binary_server::dispatch(const frames_type& a_request, frames_type& a_reply)
+{
+  check_size(a_request, 3);
+  const std::string method = a_request[0]->str();
+  a_reply.push_back(boost::make_shared<frame>("ok"));
+  if (method == "getInterface")
+  {
+    get_interface(a_request, a_reply);
+  }
+  else if (method == "getMovement")
+  {
+    get_movement(a_request, a_reply);
+  }
+  else if (method == "setLoading")
+  {
+    set_loading(a_request, a_reply);
+  }
+  else if (method == "exchange")
+  {
+    exchange(a_request, a_reply);
+  }
+  else
+  {
+    boost::format fmt("Unknown method \"%1%\"");
+    throw make_exception(boost::str(fmt % method));
+  }
+}
+
+void
+binary_server::get_interface(const frames_type& a_request,
+                             frames_type& a_reply)
+{
+  typedef handler::matrix_type matrix_type;
+  typedef arma::Mat<float> float_matrix_type;
+  typedef std::vector<std::int32_t> integers_type;
+
+  check_size(a_request, 4);
+  const precision_type precision = get_precision(a_request);
+  const std::vector<std::int64_t> keys = get_keys(*a_request[3]);
+  if (keys.size() != 1)
+  {
+    throw make_exception("Expected a single load key");
+  }
+
+  // The handler gathers the interface straight into these arrays, and the
+  // frames point into them, one column of coordinates at a time.
+  boost::shared_ptr<matrix_type> coordinates =
+      boost::make_shared<matrix_type>();
+  boost::shared_ptr<integers_type> types = boost::make_shared<integers_type>();
+  boost::shared_ptr<integers_type> vertices =
+      boost::make_shared<integers_type>();
+  handler::runner_lock runner_ = m_handler->get_runner(a_request[1]->str());
+  m_handler->get_interface(*runner_, keys[0], *coordinates, *types, *vertices);
+
+  if (precision == FLOAT32)
+  {
+    boost::shared_ptr<float_matrix_type> values =
+        boost::make_shared<float_matrix_type>(
+            arma::conv_to<float_matrix_type>::from(*coordinates));
+    for (arma::uword dim = 0; dim < 3; ++dim)
+    {
+      a_reply.push_back(boost::make_shared<frame>(
+          values->colptr(dim), values->n_rows * sizeof(float), values));
+    }
+  }
+  else
+  {
+    for (arma::uword dim = 0; dim < 3; ++dim)
+    {
+      a_reply.push_back(boost::make_shared<frame>(
+          coordinates->colptr(dim), coordinates->n_rows * sizeof(double),
+          coordinates));
+    }
+  }
+  a_reply.push_back(boost::make_shared<frame>(
+      types->data(), types->size() * sizeof(std::int32_t), types));
+  a_reply.push_back(boost::make_shared<frame>(
+      vertices->data(), vertices->size() * sizeof(std::int32_t), vertices));
+}
+
+void
+binary_server::get_movement(const frames_type& a_request,
+                            frames_type& a_reply)
+{
+  check_size(a_request, 4);
+  const precision_type precision = get_precision(a_request);
+  const std::vector<std::int64_t> keys = get_keys(*a_request[3]);
+  if (keys.size() != 1)
+  {
+    throw make_exception("Expected a single load key");
+  }
+
+  handler::runner_lock runner_ = m_handler->get_runner(a_request[1]->str());
+  add_movement(*runner_, keys[0], precision, a_reply);
+}
+
+void
+binary_server::set_loading(const frames_type& a_request,
+                           frames_type& a_reply)
+{
+  check_size(a_request, 5);
+  const precision_type precision = get_precision(a_request);
+  const std::vector<std::int64_t> keys = get_keys(*a_request[3]);
+  if (keys.size() != 1)
+  {
+    throw make_exception("Expected a single load key");
+  }
+
+  handler::runner_lock runner_ = m_handler->get_runner(a_request[1]->str());
+  set_loading(*runner_, keys[0], precision, *a_request[4]);
+}
+
+void
+binary_server::exchange(const frames_type& a_request, frames_type& a_reply)
+{
+  check_size(a_request, 6);
+  const precision_type precision = get_precision(a_request);
+  const bool subiterate = a_request[3]->size() > 0
+      && *static_cast<const char*>(a_request[3]->data()) != 0;
+  const std::vector<std::int64_t> load_keys = get_keys(*a_request[4]);
+  const std::vector<std::int64_t> movement_keys = get_keys(*a_request[5]);
+  check_size(a_request, 6 + load_keys.size());
+
+  const std::string job = a_request[1]->str();
+  // Every loading is checked before any of them is applied, so that a bad
+  // one leaves the job untouched.
+  handler::runner_lock runner_ = m_handler->get_runner(job);
+  for (size_t n = 0; n < load_keys.size(); ++n)
+  {
+    const size_t size = get_number_of_pressures(precision, *a_request[6 + n]);
+    m_handler->check_loading(*runner_, load_keys[n], size);
+  }
+  for (size_t n = 0; n < load_keys.size(); ++n)
+  {
+    set_loading(*runner_, load_keys[n], precision, *a_request[6 + n]);
+  }
+
+  try
+  {
+    if (subiterate)
+    {
+      runner_->subiterate();
+    }
+    else
+    {
+      runner_->step();
+    }
+  }
+  catch (std::exception& e)
+  {
+    boost::format fmt("Failed to step the job %1%");
+    throw make_exception(boost::str(fmt % job));
+  }
+
+  for (size_t n = 0; n < movement_keys.size(); ++n)
+  {
+    add_movement(*runner_, movement_keys[n], precision, a_reply);
+  }
+}
+
+void
+binary_server::add_movement(handler::runner_type& a_runner,
+                            std::int64_t a_loadKey,
+                            precision_type a_precision,
+                            frames_type& a_reply)
+{
+  typedef handler::matrix_type matrix_type;
+  typedef arma::Mat<float> float_matrix_type;
+
+  // The frame points straight into the matrix that receives the product.
+  boost::shared_ptr<matrix_type> movement = boost::make_shared<matrix_type>();
+  m_handler->get_movement(a_runner, a_loadKey, *movement);
+  if (a_precision == FLOAT32)
+  {
+    boost::shared_ptr<float_matrix_type> values =
+        boost::make_shared<float_matrix_type>(
+            arma::conv_to<float_matrix_type>::from(*movement));
+    a_reply.push_back(boost::make_shared<frame>(
+        values->memptr(), values->n_elem * sizeof(float), values));
+  }
+  else
+  {
+    a_reply.push_back(boost::make_shared<frame>(
+        movement->memptr(), movement->n_elem * sizeof(double), movement));
+  }
+}
+
+void
+binary_server::set_loading(handler::runner_type& a_runner,
+                           std::int64_t a_loadKey,
+                           precision_type a_precision,
+                           const frame& a_pressures)
+{
+  // 64-bit pressures are used where they lie in the frame.  Only 32-bit
+  // pressures, or the rare frame that is not suitably aligned, are copied.
+  const size_t size = get_number_of_pressures(a_precision, a_pressures);
+  const void* data = a_pressures.data();
+  bool aligned = reinterpret_cast<uintptr_t>(data) % alignof(double) == 0;
+  if (a_precision == FLOAT64 && aligned)
+  {
+    m_handler->set_loading(a_runner, a_loadKey,
+                           static_cast<const double*>(data), size);
+    return;
+  }
+
+  std::vector<double> pressures(size);
+  if (a_precision == FLOAT32)
+  {
+    std::vector<float> values(size);
+    std::memcpy(values.data(), data, size * sizeof(float));
+    pressures.assign(values.begin(), values.end());
+  }
+  else
+  {
+    std::memcpy(pressures.data(), data, size * sizeof(double));
+  }
+  m_handler->set_loading(a_runner, a_loadKey, pressures.data(), size);
+}
+
+binary_server::precision_type
+binary_server::get_precision(const frames_type& a_request)
+{
+  const frame& flag = *a_request[2];
+  if (flag.size() != 1)
+  {
+    throw make_exception("Expected a one-byte precision flag");
+  }
+  switch (*static_cast<const char*>(flag.data()))
+  {
+    case FLOAT64:
+      return FLOAT64;
+    case FLOAT32:
+      return FLOAT32;
+  }
+  throw make_exception("Unknown precision");
+}
+
+size_t
+binary_server::get_number_of_pressures(precision_type a_precision,
+                                       const frame& a_frame)
+{
+  const size_t width =
+      (a_precision == FLOAT32) ? sizeof(float) : sizeof(double);
+  if (a_frame.size() % width != 0)
+  {
+    throw make_exception("The pressures do not fill a whole frame");
+  }
+  return a_frame.size() / width;
+}
+
+std::vector<std::int64_t>
+binary_server::get_keys(const frame& a_frame)
+{
+  if (a_frame.size() % sizeof(std::int64_t) != 0)
+  {
+    throw make_exception("Expected a frame of 64-bit keys");
+  }
+  std::vector<std::int64_t> keys(a_frame.size() / sizeof(std::int64_t));
+  if (!keys.empty())
+  {
+    std::memcpy(keys.data(), a_frame.data(), a_frame.size());
+  }
+  return keys;
+}
+
+void
+binary_server::check_size(const frames_type& a_request, size_t a_size)
+{
+  if (a_request.size() < a_size)
+  {
+    boost::format fmt("Expected at least %1% frames but received %2%");
+    throw make_exception(boost::str(fmt % a_size % a_request.size()));
+  }
+}
+
+} // server namespace
+} // yamss namespace
@@ -64,6 +64,18 @@ clp::initialize()
     )(
       "keep,k",
       "keep working files on the server"
+    )(
+      "binary,b",
+      po::value<std::string>()->implicit_value("tcp://*:49201"),
+      "also serve interface data as raw binary frames"
+    )(
+      "publish,p",
+      po::value<std::string>()->implicit_value("tcp://*:49202"),
+      "publish the state of selected jobs"
+    )(
+      "workers,w",
+      po::value<size_t>(),
+      "number of server threads (default: one per core)"
     );
 #endif
   m_positional.add("input-filename", 1);
@@ -192,6 +204,41 @@ clp::server_endpoint() const
   return m_variables_map["server"].as<std::string>();
 }
 
+bool
+clp::binary_mode() const
+{
+  return m_variables_map.count("binary") == 1;
+}
+
+std::string
+clp::binary_endpoint() const
+{
+  return m_variables_map["binary"].as<std::string>();
+}
+
+bool
+clp::publish_mode() const
+{
+  return m_variables_map.count("publish") == 1;
+}
+
+std::string
+clp::publish_endpoint() const
+{
+  return m_variables_map["publish"].as<std::string>();
+}
+
+size_t
+clp::number_of_workers() const
+{
+  size_t workers = std::thread::hardware_concurrency();
+  if (m_variables_map.count("workers") == 1)
+  {
+    workers = m_variables_map["workers"].as<size_t>();
+  }
+  return workers > 0 ? workers : 1;
+}
+
 #endif // YAMSS_SUPPORTS_SERVER_MODE
 
 } // yamss namespace
@@ -1,23 +1,27 @@
+#include <stdexcept>
+#include <utility>
+#include <boost/format.hpp>
 #include "yamss/element.hpp"
 
 namespace yamss {
 
 element::element()
+  : m_storage(0)
+  , m_index(0)
 {
   // empty
 }
 
-element::element(key_type a_key, shape_type a_shape)
-  : m_key(a_key)
-  , m_vertices()
+element::element(element_storage& a_storage, size_type a_index)
+  : m_storage(&a_storage)
+  , m_index(a_index)
 {
-  set_shape(a_shape);
+  // empty
 }
 
 element::element(const element& a_other)
-  : m_key(a_other.m_key)
-  , m_shape(a_other.m_shape)
-  , m_vertices(a_other.m_vertices)
+  : m_storage(a_other.m_storage)
+  , m_index(a_other.m_index)
 {
   // empty
 }
@@ -30,73 +34,263 @@ element::~element()
 element&
 element::operator=(const element& a_other)
 {
-  m_key = a_other.m_key;
-  m_shape = a_other.m_shape;
-  m_vertices = a_other.m_vertices;
+  m_storage = a_other.m_storage;
+  m_index = a_other.m_index;
   return *this;
 }
 
 element::key_type
 element::get_key() const
 {
-  return m_key;
+  return m_storage->get_key(m_index);
+}
+
+element::size_type
+element::get_index() const
+{
+  return m_index;
 }
 
 element::shape_type
 element::get_shape() const
 {
-  return m_shape;
+  return m_storage->get_shape(m_index);
 }
 
 element::size_type
 element::get_size() const
 {
-  return m_vertices.size();
+  return m_storage->get_number_of_vertices(m_index);
 }
 
 element::key_type
 element::get_vertex(size_type a_pos) const
 {
-  return m_vertices[a_pos];
+  return m_storage->get_vertex_key(m_index, a_pos);
 }
 
-const element::vector_type&
+element::size_type
+element::get_vertex_index(size_type a_pos) const
+{
+  return m_storage->get_vertex_index(m_index, a_pos);
+}
+
+element::vector_type
 element::get_vertices() const
 {
-  return m_vertices;
+  const size_type n_vertices = get_size();
+  vector_type vertices(n_vertices);
+  for (size_type pos = 0; pos < n_vertices; ++pos)
+  {
+    vertices[pos] = get_vertex(pos);
+  }
+  return vertices;
 }
 
 void
 element::set_vertex(size_type a_pos, key_type a_vertex)
 {
-  m_vertices[a_pos] = a_vertex;
+  m_storage->set_vertex(m_index, a_pos, a_vertex);
 }
 
 void
 element::set_vertices(const vector_type& a_vertices)
 {
-  m_vertices = a_vertices;
+  const size_type n_vertices = get_size();
+  for (size_type pos = 0; pos < n_vertices && pos < a_vertices.size(); ++pos)
+  {
+    set_vertex(pos, a_vertices[pos]);
+  }
 }
 
-void
-element::set_shape(shape_type a_shape)
+element::size_type
+element::get_size(shape_type a_shape)
 {
-  m_shape = a_shape;
-  switch (m_shape)
+  switch (a_shape)
   {
     case POINT:
-      m_vertices.resize(1);
-      break;
+      return 1;
     case LINE:
-      m_vertices.resize(2);
-      break;
+      return 2;
     case TRIANGLE:
-      m_vertices.resize(3);
-      break;
+      return 3;
     case QUADRILATERAL:
-      m_vertices.resize(4);
-      break;
+      return 4;
+  }
+  return 0;
+}
+
+const element_storage::size_type element_storage::no_vertex;
+
+element_storage::element_storage(const keys_type& a_node_keys,
+                                 const indices_type& a_node_indices)
+  : m_node_keys(&a_node_keys)
+  , m_node_indices(&a_node_indices)
+  , m_offsets(1, 0)
+  , m_version(0)
+{
+  // empty
+}
+
+element_storage::~element_storage()
+{
+  // empty
+}
+
+element_storage::size_type
+element_storage::get_size() const
+{
+  return m_keys.size();
+}
+
+element_storage::size_type
+element_storage::add(key_type a_key, shape_type a_shape)
+{
+  const size_type index = m_keys.size();
+  if (!m_indices.insert(std::make_pair(a_key, index)).second)
+  {
+    boost::format fmt("Element %1% already exists.");
+    throw std::runtime_error(boost::str(fmt % a_key));
+  }
+  m_keys.push_back(a_key);
+  m_shapes.push_back(a_shape);
+  m_vertices.resize(m_vertices.size() + element::get_size(a_shape),
+                    no_vertex);
+  m_offsets.push_back(m_vertices.size());
+  ++m_version;
+  return index;
+}
+
+bool
+element_storage::find(key_type a_key, size_type& a_index) const
+{
+  indices_type::const_iterator result = m_indices.find(a_key);
+  if (result == m_indices.end())
+  {
+    return false;
+  }
+  a_index = result->second;
+  return true;
+}
+
+element_storage::key_type
+element_storage::get_key(size_type a_index) const
+{
+  return m_keys[a_index];
+}
+
+element_storage::shape_type
+element_storage::get_shape(size_type a_index) const
+{
+  return m_shapes[a_index];
+}
+
+element_storage::size_type
+element_storage::get_number_of_vertices(size_type a_index) const
+{
+  return m_offsets[a_index + 1] - m_offsets[a_index];
+}
+
+element_storage::size_type
+element_storage::get_vertex_index(size_type a_index, size_type a_pos) const
+{
+  return m_vertices[m_offsets[a_index] + a_pos];
+}
+
+element_storage::key_type
+element_storage::get_vertex_key(size_type a_index, size_type a_pos) const
+{
+  const size_type vertex = get_vertex_index(a_index, a_pos);
+  if (vertex == no_vertex)
+  {
+    boost::format fmt("Vertex %2% of element %1% has not been set.");
+    throw std::runtime_error(boost::str(fmt % m_keys[a_index] % a_pos));
+  }
+  return (*m_node_keys)[vertex];
+}
+
+void
+element_storage::set_vertex(size_type a_index,
+                            size_type a_pos,
+                            key_type a_vertex)
+{
+  if (a_pos >= get_number_of_vertices(a_index))
+  {
+    boost::format fmt("Element %1% has no vertex %2%.");
+    throw std::runtime_error(boost::str(fmt % m_keys[a_index] % a_pos));
+  }
+  indices_type::const_iterator result = m_node_indices->find(a_vertex);
+  if (result == m_node_indices->end())
+  {
+    boost::format fmt("Element %1% refers to node %2%, which does not exist.");
+    throw std::runtime_error(boost::str(fmt % m_keys[a_index] % a_vertex));
+  }
+  m_vertices[m_offsets[a_index] + a_pos] = result->second;
+  ++m_version;
+}
+
+void
+element_storage::renumber_nodes(const std::vector<size_type>& a_new_indices)
+{
+  for (size_type v = 0; v < m_vertices.size(); ++v)
+  {
+    if (m_vertices[v] != no_vertex)
+    {
+      m_vertices[v] = a_new_indices[m_vertices[v]];
+    }
   }
+  ++m_version;
+}
+
+void
+element_storage::permute(const std::vector<size_type>& a_order)
+{
+  keys_type keys(m_keys.size());
+  std::vector<shape_type> shapes(m_shapes.size());
+  std::vector<size_type> offsets(1, 0);
+  std::vector<size_type> vertices;
+  offsets.reserve(m_offsets.size());
+  vertices.reserve(m_vertices.size());
+  for (size_type e = 0; e < a_order.size(); ++e)
+  {
+    const size_type old = a_order[e];
+    keys[e] = m_keys[old];
+    shapes[e] = m_shapes[old];
+    m_indices[keys[e]] = e;
+    vertices.insert(vertices.end(),
+                    m_vertices.begin() + m_offsets[old],
+                    m_vertices.begin() + m_offsets[old + 1]);
+    offsets.push_back(vertices.size());
+  }
+  m_keys.swap(keys);
+  m_shapes.swap(shapes);
+  m_offsets.swap(offsets);
+  m_vertices.swap(vertices);
+  ++m_version;
+}
+
+const std::vector<element_storage::size_type>&
+element_storage::get_offsets() const
+{
+  return m_offsets;
+}
+
+const std::vector<element_storage::size_type>&
+element_storage::get_vertices() const
+{
+  return m_vertices;
+}
+
+const std::vector<element_storage::shape_type>&
+element_storage::get_shapes() const
+{
+  return m_shapes;
+}
+
+element_storage::size_type
+element_storage::get_version() const
+{
+  return m_version;
 }
 
 } // yamss namespace
@@ -6,6 +6,8 @@ handler::handler(const boost::filesystem::path& a_directory)
   : m_directory(a_directory)
   , m_transporter()
   , m_jobs()
+  , m_jobs_mutex()
+  , m_transporter_mutex()
 {
   // empty
 }
@@ -52,6 +54,7 @@ handler::create(const std::string& a_url)
 
   try
   {
+    std::lock_guard<std::mutex> lock(m_transporter_mutex);
     m_transporter.get(xml, a_url);
   }
   catch (transport_error& e)
@@ -74,26 +77,79 @@ handler::create(const std::string& a_url)
     throw ye;
   }
 
+  job_pointer job_ = boost::make_shared<job_type>();
+  job_->runner = runner_;
+  job_->url = url;
+
   std::string job = key.c_str();
-  m_jobs[job] = std::make_pair(runner_, url);
+  std::lock_guard<std::mutex> lock(m_jobs_mutex);
+  m_jobs[job] = job_;
   return job;
 }
 
-void
-handler::finalize(const JobKey& a_job)
+std::vector<InterfaceMovement>
+handler::exchange(const JobKey& a_job,
+                  const std::vector<std::int64_t>& a_loadKeys,
+                  const std::vector<InterfaceLoading>& a_loadings,
+                  const bool a_subiterate,
+                  const std::vector<std::int64_t>& a_movementKeys)
 {
-  namespace fs = boost::filesystem;
+  if (a_loadKeys.size() != a_loadings.size())
+  {
+    YamssException ye;
+    boost::format fmt("Expected %1% loadings but received %2%");
+    ye.what = boost::str(fmt % a_loadKeys.size() % a_loadings.size());
+    throw ye;
+  }
 
-  typename jobs_type::const_iterator job = m_jobs.find(a_job);
-  if (job == m_jobs.end())
+  // The job is looked up and locked once for the whole exchange, so no other
+  // call can slip in between the loading, the step and the movement.  Every
+  // loading is checked before any of them is applied.
+  runner_lock runner_ = get_runner(a_job);
+  for (size_type n = 0; n < a_loadKeys.size(); ++n)
+  {
+    check_loading(*runner_, a_loadKeys[n], a_loadings[n].forces.size());
+  }
+  for (size_type n = 0; n < a_loadKeys.size(); ++n)
+  {
+    set_loading(*runner_, a_loadKeys[n], a_loadings[n]);
+  }
+
+  try
+  {
+    if (a_subiterate)
+    {
+      runner_->subiterate();
+    }
+    else
+    {
+      runner_->step();
+    }
+  }
+  catch (std::exception& e)
   {
     YamssException ye;
-    boost::format fmt("Job %1% does not exist");
+    boost::format fmt("Failed to step the job %1%");
     ye.what = boost::str(fmt % a_job);
     throw ye;
   }
-  runner_pointer runner_ = job->second.first;
-  std::string url = job->second.second;
+
+  std::vector<InterfaceMovement> movements;
+  movements.reserve(a_movementKeys.size());
+  for (size_type n = 0; n < a_movementKeys.size(); ++n)
+  {
+    movements.push_back(get_movement(*runner_, a_movementKeys[n]));
+  }
+  return movements;
+}
+
+void
+handler::finalize(const JobKey& a_job)
+{
+  namespace fs = boost::filesystem;
+
+  runner_lock runner_ = get_runner(a_job);
+  std::string url = runner_.get_url();
 
   std::set<fs::path> files;
   try
@@ -116,6 +172,7 @@ handler::finalize(const JobKey& a_job)
     std::set<fs::path>::const_iterator fp;
     try
     {
+      std::lock_guard<std::mutex> lock(m_transporter_mutex);
       for (fp = files.begin(); fp != files.end(); ++fp)
       {
         local_path = m_directory / a_job / *fp;
@@ -132,9 +189,10 @@ handler::finalize(const JobKey& a_job)
   }
 }
 
-handler::runner_pointer
-handler::get_runner(const JobKey& a_job)
+handler::job_pointer
+handler::get_job(const JobKey& a_job)
 {
+  std::lock_guard<std::mutex> lock(m_jobs_mutex);
   typename jobs_type::const_iterator job = m_jobs.find(a_job);
   if (job == m_jobs.end())
   {
@@ -143,7 +201,15 @@ handler::get_runner(const JobKey& a_job)
     ye.what = boost::str(fmt % a_job);
     throw ye;
   }
-  return job->second.first;
+  return job->second;
+}
+
+handler::runner_lock
+handler::get_runner(const JobKey& a_job)
+{
+  // The table lock is released before the job lock is taken, so a long call
+  // on one job never holds up the lookup of another.
+  return runner_lock(get_job(a_job));
 }
 
 std::vector<bool>
@@ -160,93 +226,98 @@ handler::getFinalTime(const JobKey& a_job)
 
 InterfacePatch
 handler::getInterface(const JobKey& a_job, const std::int64_t a_loadKey)
+{
+  matrix_type coordinates;
+  std::vector<int32_t> types;
+  InterfacePatch patch;
+
+  runner_lock runner_ = get_runner(a_job);
+  get_interface(*runner_, a_loadKey, coordinates, types,
+                patch.elementVertices);
+  patch.x.assign(coordinates.colptr(0),
+                 coordinates.colptr(0) + coordinates.n_rows);
+  patch.y.assign(coordinates.colptr(1),
+                 coordinates.colptr(1) + coordinates.n_rows);
+  patch.z.assign(coordinates.colptr(2),
+                 coordinates.colptr(2) + coordinates.n_rows);
+  patch.elementTypes.reserve(types.size());
+  for (size_type n = 0; n < types.size(); ++n)
+  {
+    patch.elementTypes.push_back(static_cast<ElementType>(types[n]));
+  }
+  return patch;
+}
+
+void
+handler::get_interface(runner_type& a_runner,
+                       const int64_t a_loadKey,
+                       matrix_type& a_coordinates,
+                       std::vector<int32_t>& a_types,
+                       std::vector<int32_t>& a_vertices)
 {
   typedef typename runner_type::structure_pointer structure_pointer;
   typedef typename runner_type::structure_type structure_type;
   typedef typename structure_type::load_type load_type;
-  typedef typename structure_type::node_type node_type;
-  typedef typename structure_type::element_type element_type;
+  typedef typename structure_type::element_storage_type element_storage_type;
   typedef typename load_type::const_iterator const_iterator;
 
-  int32_t n;
-  load_type* load_;
-  const_iterator ep;
-  const_iterator np;
-  const_iterator beg;
-  const_iterator end;
-  runner_pointer runner_ = get_runner(a_job);
-  structure_pointer structure_ = runner_->get_structure();
-  boost::unordered_map<key_type, int32_t> node_order;
+  structure_pointer structure_ = a_runner.get_structure();
+
+  // The positions are read from the node storage and the connectivity from
+  // the compressed rows of the element storage.  Vertices are renumbered
+  // from node indices of the structure to positions in the load.
 
   key_type key = static_cast<key_type>(a_loadKey);
   try
   {
-    load_ = &(structure_->get_load(a_loadKey));
-  }
-  catch (std::runtime_error& e)
-  {
-    YamssException ye;
-    ye.what = e.what();
-    throw ye;
-  }
-
-  size_type n_nodes = load_->get_number_of_nodes();
-  size_type n_elements = load_->get_number_of_elements();
+    const load_type& load_ = structure_->get_load(key);
+    const element_storage_type& elements = structure_->get_element_storage();
+    const std::vector<size_type>& offsets = elements.get_offsets();
+    const std::vector<size_type>& vertices = elements.get_vertices();
+    const matrix_type positions = structure_->get_positions();
 
-  InterfacePatch patch;
-  patch.x.resize(n_nodes);
-  patch.y.resize(n_nodes);
-  patch.z.resize(n_nodes);
-  patch.elementTypes.resize(n_elements);
-  patch.elementVertices.clear();
-
-  try
-  {
-    beg = load_->begin_nodes();
-    end = load_->end_nodes();
-    for (n = 0, np = beg; np != end; ++n, ++np)
+    std::vector<int32_t> order(positions.n_cols, -1);
+    const_iterator np = load_.begin_nodes();
+    a_coordinates.set_size(load_.get_number_of_nodes(), 3);
+    for (int32_t n = 0; np != load_.end_nodes(); ++n, ++np)
     {
-      const node_type& node_ = structure_->get_node(*np);
-      const typename node_type::vector_type& position = node_.get_position();
-      node_order[node_.get_key()] = n;
-      patch.x[n] = position(0);
-      patch.y[n] = position(1);
-      patch.z[n] = position(2);
+      const size_type index = structure_->get_node_index(*np);
+      order[index] = n;
+      a_coordinates(n, 0) = positions(0, index);
+      a_coordinates(n, 1) = positions(1, index);
+      a_coordinates(n, 2) = positions(2, index);
     }
-  }
-  catch (std::runtime_error& e)
-  {
-    YamssException ye;
-    ye.what = e.what();
-    throw ye;
-  }
 
-  try
-  {
-    beg = load_->begin_elements();
-    end = load_->end_elements();
-    for (n = 0, ep = beg; ep != end; ++n, ++ep)
+    const_iterator ep = load_.begin_elements();
+    a_types.clear();
+    a_types.reserve(load_.get_number_of_elements());
+    a_vertices.clear();
+    for (; ep != load_.end_elements(); ++ep)
     {
-      const element_type& elem_ = structure_->get_element(*ep);
-      const typename element_type::vector_type& vertices = elem_.get_vertices();
-      switch (elem_.get_shape())
+      const size_type e = structure_->get_element_index(*ep);
+      switch (elements.get_shape(e))
       {
-        case element_type::POINT:
-          patch.elementTypes[n] = ElementType::POINT;
+        case element::POINT:
+          a_types.push_back(POINT);
           break;
-        case element_type::LINE:
-          patch.elementTypes[n] = ElementType::LINE;
+        case element::LINE:
+          a_types.push_back(LINE);
           break;
-        case element_type::TRIANGLE:
-          patch.elementTypes[n] = ElementType::TRIANGLE;
+        case element::TRIANGLE:
+          a_types.push_back(TRIANGLE);
           break;
-        case element_type::QUADRILATERAL:
-          patch.elementTypes[n] = ElementType::QUADRILATERAL;
+        case element::QUADRILATERAL:
+          a_types.push_back(QUADRILATERAL);
           break;
       }
-      for (size_type m = 0; m < vertices.size(); ++m)
+      for (size_type v = offsets[e]; v < offsets[e + 1]; ++v)
       {
-        patch.elementVertices.push_back(node_order[vertices[m]]);
+        if (vertices[v] >= order.size())
+        {
+          boost::format fmt("Element %1% has a vertex that has not been set.");
+          throw std::runtime_error(boost::str(fmt % *ep));
+        }
+        a_vertices.push_back(order[vertices[v]]);
       }
     }
   }
@@ -256,87 +327,55 @@ handler::getInterface(const JobKey& a_job, const std::int64_t a_loadKey)
     ye.what = e.what();
     throw ye;
   }
-
-  return patch;
 }
 
 InterfaceMovement
 handler::getMovement(const JobKey& a_job, const int64_t a_loadKey)
 {
-  typedef typename runner_type::eom_pointer eom_pointer;
-  typedef typename runner_type::eom_type eom_type;
-  typedef typename runner_type::structure_pointer structure_pointer;
-  typedef typename runner_type::structure_type structure_type;
-  typedef typename structure_type::load_type load_type;
-  typedef typename structure_type::node_type node_type;
-  typedef typename load_type::const_iterator const_iterator;
-
-  int32_t n;
-  size_type pos;
-  load_type* load_;
-  const_iterator np;
-  const_iterator beg;
-  const_iterator end;
-  runner_pointer runner_ = get_runner(a_job);
-  eom_pointer eom_ = runner_->get_eom();
-  structure_pointer structure_ = runner_->get_structure();
-
-  key_type key = static_cast<key_type>(a_loadKey);
-  try
-  {
-    load_ = &(structure_->get_load(a_loadKey));
-  }
-  catch (std::runtime_error& e)
-  {
-    YamssException ye;
-    ye.what = e.what();
-    throw ye;
-  }
+  runner_lock runner_ = get_runner(a_job);
+  return get_movement(*runner_, a_loadKey);
+}
 
-  size_type n_dofs = structure_->get_number_of_active_dofs();
-  size_type n_nodes = load_->get_number_of_nodes();
+InterfaceMovement
+handler::get_movement(runner_type& a_runner, const int64_t a_loadKey)
+{
+  matrix_type movement_;
+  get_movement(a_runner, a_loadKey, movement_);
 
   InterfaceMovement movement;
-  movement.displacements.resize(n_dofs * n_nodes);
-  movement.velocities.resize(n_dofs * n_nodes);
-  movement.accelerations.resize(n_dofs * n_nodes);
+  movement.displacements.assign(movement_.colptr(0),
+                                movement_.colptr(0) + movement_.n_rows);
+  movement.velocities.assign(movement_.colptr(1),
+                             movement_.colptr(1) + movement_.n_rows);
+  movement.accelerations.assign(movement_.colptr(2),
+                                movement_.colptr(2) + movement_.n_rows);
+  return movement;
+}
 
-  std::vector<int32_t> offsets(6);
-  offsets[0] = 0;
-  for (n = 1; n < 6; ++n)
-  {
-    if (structure_->is_active(n - 1))
-    {
-      offsets[n] = offsets[n - 1] + n_nodes;
-    }
-    else
-    {
-      offsets[n] = offsets[n - 1];
-    }
-  }
+void
+handler::get_movement(runner_type& a_runner,
+                      const int64_t a_loadKey,
+                      matrix_type& a_movement)
+{
+  typedef typename runner_type::eom_pointer eom_pointer;
+  typedef typename runner_type::structure_pointer structure_pointer;
+
+  eom_pointer eom_ = a_runner.get_eom();
+  structure_pointer structure_ = a_runner.get_structure();
 
-  typename eom_type::vector_type q = eom_->get_displacement(0);
-  typename eom_type::vector_type dq = eom_->get_velocity(0);
-  typename eom_type::vector_type ddq = eom_->get_acceleration(0);
+  // The displacements, velocities and accelerations of all of the nodes of
+  // the load come from a single product of the cached mode matrix of the
+  // load with the generalized displacements, velocities and accelerations.
 
+  key_type key = static_cast<key_type>(a_loadKey);
   try
   {
-    beg = load_->begin_nodes();
-    end = load_->end_nodes();
-    for (n = 0, np = beg; np != end; ++n, ++np)
-    {
-      const node_type& node_ = structure_->get_node(*np);
-      for (size_type dof = 0; dof < 6; ++dof)
-      {
-        if (structure_->is_active(dof))
-        {
-          pos = offsets[dof] + n;
-          movement.displacements[pos] = node_.get_displacement(dof, q);
-          movement.velocities[pos] = node_.get_velocity(dof, dq);
-          movement.accelerations[pos] = node_.get_acceleration(dof, ddq);
-        }
-      }
-    }
+    const matrix_type& modes = structure_->get_load_modes(key);
+    matrix_type q(modes.n_cols, 3);
+    q.col(0) = eom_->get_displacement(0);
+    q.col(1) = eom_->get_velocity(0);
+    q.col(2) = eom_->get_acceleration(0);
+    a_movement = modes * q;
   }
   catch (std::runtime_error& e)
   {
@@ -344,8 +383,6 @@ handler::getMovement(const JobKey& a_job, const int64_t a_loadKey)
     ye.what = e.what();
     throw ye;
   }
-
-  return movement;
 }
 
 std::vector<double>
@@ -354,7 +391,7 @@ handler::getModes(const JobKey& a_job)
   typedef ::arma::Col<double> vector_type;
   typedef ::arma::conv_to<std::vector<double> > converter;
 
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   const vector_type& q = runner_->get_eom()->get_displacement(0);
   return converter::from(q);
 }
@@ -366,7 +403,7 @@ handler::getNode(const JobKey& a_job, const int64_t a_nodeKey)
   typedef ::arma::conv_to<std::vector<double> > converter;
   typedef typename runner_type::structure_type::node_type node_type;
 
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   key_type key = static_cast<key_type>(a_nodeKey);
   const node_type& node_ = runner_->get_structure()->get_node(key);
   const vector_type& q = runner_->get_eom()->get_displacement(0);
@@ -398,7 +435,7 @@ handler::getState(const JobKey& a_job)
 {
   typedef ::arma::conv_to<std::vector<double> > converter;
 
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   typename runner_type::eom_pointer eom_ = runner_->get_eom();
 
   State state;
@@ -426,7 +463,7 @@ handler::getTimeStep(const JobKey& a_job)
 void
 handler::initialize(const JobKey& a_job)
 {
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   try
   {
     runner_->initialize(m_directory / a_job);
@@ -443,6 +480,7 @@ handler::initialize(const JobKey& a_job)
 void
 handler::release(const JobKey& a_job)
 {
+  std::lock_guard<std::mutex> lock(m_jobs_mutex);
   m_jobs.erase(a_job);
 }
 
@@ -455,7 +493,7 @@ handler::report(const JobKey& a_job)
 void
 handler::run(const JobKey& a_job)
 {
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   try
   {
     runner_->run();
@@ -489,17 +527,31 @@ void
 handler::setLoading(const JobKey& a_job,
                     const int64_t a_load,
                     const InterfaceLoading& a_loading)
+{
+  runner_lock runner_ = get_runner(a_job);
+  set_loading(*runner_, a_load, a_loading);
+}
+
+void
+handler::set_loading(runner_type& a_runner,
+                     const int64_t a_load,
+                     const InterfaceLoading& a_loading)
+{
+  set_loading(a_runner, a_load, a_loading.forces.data(),
+              a_loading.forces.size());
+}
+
+void
+handler::check_loading(runner_type& a_runner,
+                       const int64_t a_load,
+                       size_type a_size)
 {
   typedef typename runner_type::structure_type structure_type;
   typedef typename structure_type::load_type load_type;
   typedef typename evaluator::interface<double> interface_type;
-  typedef ::arma::Col<double> vector_type;
-  typedef ::arma::Mat<double> matrix_type;
 
   load_type* load_;
-  auto runner_ = get_runner(a_job);
-  auto structure_ = runner_->get_structure();
-  auto key = static_cast<key_type>(a_load);
+  auto structure_ = a_runner.get_structure();
   try
   {
     load_ = &(structure_->get_load(a_load));
@@ -515,85 +567,61 @@ handler::setLoading(const JobKey& a_job,
       load_->get_evaluator()
     );
 
-  boost::unordered_map<key_type, int32_t> node_order;
-
-  try
-  {
-    auto beg = load_->begin_nodes();
-    auto end = load_->end_nodes();
-    auto np = beg;
-    for (auto n = 0; np != end; ++n, ++np)
-    {
-      node_order[structure_->get_node(*np).get_key()] = n;
-    }
-  }
-  catch (std::runtime_error& e)
+  if (!evaluator_)
   {
     YamssException ye;
-    ye.what = e.what();
+    boost::format fmt("Load %1% is not an interface load");
+    ye.what = boost::str(fmt % a_load);
     throw ye;
   }
 
-  auto n_dofs = structure_->get_number_of_active_dofs();
   auto n_nodes = load_->get_number_of_nodes();
-  auto n_elements = load_->get_number_of_elements();
-  matrix_type forces = arma::zeros<matrix_type>(3, n_nodes);
-
-  try
-  {
-    auto element_end = structure_->end_elements();
-    auto element_begin = structure_->begin_elements();
-    auto element_index = 0;
-    auto element_ptr = element_begin;
-    while (element_ptr != element_end)
-    {
-      const auto& vertices = element_ptr->get_vertices();
-      auto n_vertices = vertices.size();
-
-      auto pressure = 0.0;
-      for (auto vertex_index = 0; vertex_index < n_vertices; ++vertex_index)
-      {
-        auto vertex_key = vertices[vertex_index];
-        auto force_index = node_order[vertex_key];
-        pressure += a_loading.forces[force_index];
-      }
-      pressure /= n_vertices;
-
-      auto area = structure_->get_element_area(*element_ptr);
-      auto normal = structure_->get_element_normal(*element_ptr);
-      auto force = (pressure * area / n_vertices) * normal;
-
-      for (auto vertex_index = 0; vertex_index < n_vertices; ++vertex_index)
-      {
-        auto vertex_key = vertices[vertex_index];
-        auto force_index = node_order[vertex_key];
-        forces.col(force_index) += force;
-      }
-
-      ++element_ptr;
-      ++element_index;
-    }
-  }
-  catch (std::runtime_error& e)
+  if (a_size != n_nodes)
   {
     YamssException ye;
-    ye.what = e.what();
+    boost::format fmt("Expected %1% pressures for load %2% but received %3%");
+    ye.what = boost::str(fmt % n_nodes % a_load % a_size);
     throw ye;
   }
+}
+
+void
+handler::set_loading(runner_type& a_runner,
+                     const int64_t a_load,
+                     const double* a_pressures,
+                     size_type a_size)
+{
+  typedef typename runner_type::structure_type structure_type;
+  typedef typename structure_type::load_type load_type;
+  typedef typename evaluator::interface<double> interface_type;
+  typedef ::arma::Col<double> vector_type;
+
+  check_loading(a_runner, a_load, a_size);
+  auto structure_ = a_runner.get_structure();
+  auto key = static_cast<key_type>(a_load);
+  load_type* load_ = &(structure_->get_load(a_load));
+  auto evaluator_ = boost::dynamic_pointer_cast<interface_type>(
+      load_->get_evaluator()
+    );
+
+  // The pressures are mapped to nodal forces by a sparse operator that the
+  // structure builds once per load.
 
   try
   {
-    std::vector<double> f;
-    vector_type ff = ::arma::zeros<vector_type>(6);
+    const auto& pressure_operator = structure_->get_pressure_operator(key);
+    const vector_type pressures(const_cast<double*>(a_pressures), a_size,
+                                false, true);
+    const vector_type forces = pressure_operator * pressures;
+
+    vector_type f = ::arma::zeros<vector_type>(6);
     auto beg = load_->begin_nodes();
     auto end = load_->end_nodes();
     auto np = beg;
     for (auto n = 0; np != end; ++n, ++np)
     {
-      const auto& node_ = structure_->get_node(*np);
-      ff.head(3) = forces.col(n);
-      f = arma::conv_to<std::vector<double>>::from(ff);
-      evaluator_->insert(node_.get_key(), f);
+      f.head(3) = forces.subvec(3 * n, 3 * n + 2);
+      evaluator_->insert(*np, f);
     }
   }
   catch (std::runtime_error& e)
@@ -607,7 +635,7 @@ handler::setLoading(const JobKey& a_job,
 void
 handler::step(const JobKey& a_job)
 {
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   try
   {
     runner_->step();
@@ -624,7 +652,7 @@ handler::step(const JobKey& a_job)
 void
 handler::stepN(const JobKey& a_job, const std::int32_t a_steps)
 {
-  runner_pointer runner_ = get_runner(a_job);
+  runner_lock runner_ = get_runner(a_job);
   try
   {
     for (size_type n = 0; n < a_steps; ++n)
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include "yamss/ordering.hpp"
+
+namespace yamss {
+
+namespace {
+
+typedef size_t size_type;
+
+// Spread the low 21 bits of a_value so that there are two zero bits between
+// each pair of consecutive bits.
+
+std::uint64_t
+spread_bits(std::uint64_t a_value)
+{
+  a_value &= 0x1fffff;
+  a_value = (a_value | (a_value << 32)) & 0x1f00000000ffffULL;
+  a_value = (a_value | (a_value << 16)) & 0x1f0000ff0000ffULL;
+  a_value = (a_value | (a_value << 8)) & 0x100f00f00f00f00fULL;
+  a_value = (a_value | (a_value << 4)) & 0x10c30c30c30c30c3ULL;
+  a_value = (a_value | (a_value << 2)) & 0x1249249249249249ULL;
+  return a_value;
+}
+
+class degree_less
+{
+public:
+  degree_less(const std::vector<size_type>& a_offsets)
+    : m_offsets(a_offsets)
+  {
+    // empty
+  }
+
+  bool
+  operator()(size_type a_lhs, size_type a_rhs) const
+  {
+    const size_type lhs = m_offsets[a_lhs + 1] - m_offsets[a_lhs];
+    const size_type rhs = m_offsets[a_rhs + 1] - m_offsets[a_rhs];
+    return lhs < rhs || (lhs == rhs && a_lhs < a_rhs);
+  }
+private:
+  const std::vector<size_type>& m_offsets;
+}; // degree_less class
+
+class code_less
+{
+public:
+  code_less(const std::vector<std::uint64_t>& a_codes)
+    : m_codes(a_codes)
+  {
+    // empty
+  }
+
+  bool
+  operator()(size_type a_lhs, size_type a_rhs) const
+  {
+    return m_codes[a_lhs] < m_codes[a_rhs];
+  }
+private:
+  const std::vector<std::uint64_t>& m_codes;
+}; // code_less class
+
+} // anonymous namespace
+
+std::vector<size_t>
+reverse_cuthill_mckee(size_t a_number_of_nodes,
+                      const std::vector<size_t>& a_offsets,
+                      const std::vector<size_t>& a_vertices)
+{
+  const size_type n_nodes = a_number_of_nodes;
+  const size_type n_elements = a_offsets.empty() ? 0 : a_offsets.size() - 1;
+
+  // Build the node adjacency graph, also in compressed sparse row form.
+  std::vector<size_type> offsets(n_nodes + 1, 0);
+  for (size_type e = 0; e < n_elements; ++e)
+  {
+    size_type n_vertices = 0;
+    for (size_type v = a_offsets[e]; v < a_offsets[e + 1]; ++v)
+    {
+      n_vertices += (a_vertices[v] < n_nodes) ? 1 : 0;
+    }
+    for (size_type v = a_offsets[e]; v < a_offsets[e + 1]; ++v)
+    {
+      if (a_vertices[v] < n_nodes)
+      {
+        offsets[a_vertices[v] + 1] += n_vertices - 1;
+      }
+    }
+  }
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    offsets[n + 1] += offsets[n];
+  }
+  std::vector<size_type> neighbors(offsets[n_nodes]);
+  std::vector<size_type> next(offsets.begin(), offsets.end() - 1);
+  for (size_type e = 0; e < n_elements; ++e)
+  {
+    for (size_type v = a_offsets[e]; v < a_offsets[e + 1]; ++v)
+    {
+      for (size_type w = a_offsets[e]; w < a_offsets[e + 1]; ++w)
+      {
+        if (v != w && a_vertices[v] < n_nodes && a_vertices[w] < n_nodes)
+        {
+          neighbors[next[a_vertices[v]]++] = a_vertices[w];
+        }
+      }
+    }
+  }
+
+  // Remove duplicate neighbors, compacting the graph in place.
+  size_type end = 0;
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    std::vector<size_type>::iterator first = neighbors.begin() + offsets[n];
+    std::vector<size_type>::iterator last = neighbors.begin() + offsets[n + 1];
+    std::sort(first, last);
+    last = std::unique(first, last);
+    offsets[n] = end;
+    end = std::copy(first, last, neighbors.begin() + end) - neighbors.begin();
+  }
+  offsets[n_nodes] = end;
+
+  // Visit each connected component breadth first, starting from a node of
+  // least degree and visiting neighbors in order of increasing degree.
+  const degree_less less(offsets);
+  std::vector<size_type> candidates(n_nodes);
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    candidates[n] = n;
+  }
+  std::sort(candidates.begin(), candidates.end(), less);
+
+  std::vector<size_type> order;
+  std::vector<bool> visited(n_nodes, false);
+  std::vector<size_type> adjacent;
+  order.reserve(n_nodes);
+  for (size_type c = 0; c < n_nodes; ++c)
+  {
+    if (visited[candidates[c]])
+    {
+      continue;
+    }
+    size_type head = order.size();
+    order.push_back(candidates[c]);
+    visited[candidates[c]] = true;
+    while (head < order.size())
+    {
+      const size_type n = order[head++];
+      adjacent.clear();
+      for (size_type k = offsets[n]; k < offsets[n + 1]; ++k)
+      {
+        if (!visited[neighbors[k]])
+        {
+          visited[neighbors[k]] = true;
+          adjacent.push_back(neighbors[k]);
+        }
+      }
+      std::sort(adjacent.begin(), adjacent.end(), less);
+      order.insert(order.end(), adjacent.begin(), adjacent.end());
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+std::vector<size_t>
+morton_order(const std::vector<double>& a_coordinates)
+{
+  const size_type n_nodes = a_coordinates.size() / 3;
+  double lower[3];
+  double upper[3];
+  for (size_type c = 0; c < 3; ++c)
+  {
+    lower[c] = std::numeric_limits<double>::max();
+    upper[c] = -std::numeric_limits<double>::max();
+  }
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    for (size_type c = 0; c < 3; ++c)
+    {
+      lower[c] = std::min(lower[c], a_coordinates[3 * n + c]);
+      upper[c] = std::max(upper[c], a_coordinates[3 * n + c]);
+    }
+  }
+
+  // Quantize each coordinate to 21 bits and interleave the bits.
+  const double cells = static_cast<double>(0x1fffff);
+  std::vector<std::uint64_t> codes(n_nodes);
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    std::uint64_t code = 0;
+    for (size_type c = 0; c < 3; ++c)
+    {
+      const double extent = upper[c] - lower[c];
+      double u = 0.0;
+      if (extent > 0.0)
+      {
+        u = (a_coordinates[3 * n + c] - lower[c]) / extent;
+      }
+      code |= spread_bits(static_cast<std::uint64_t>(u * cells)) << c;
+    }
+    codes[n] = code;
+  }
+
+  std::vector<size_t> order(n_nodes);
+  for (size_type n = 0; n < n_nodes; ++n)
+  {
+    order[n] = n;
+  }
+  std::stable_sort(order.begin(), order.end(), code_less(codes));
+  return order;
+}
+
+} // yamss namespace
@@ -0,0 +1,678 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "yamss/evaluator/program.hpp"
+
+namespace yamss {
+namespace evaluator {
+
+// The parser is a recursive descent parser over the following grammar,
+// which follows the Lua precedence rules.  Anything outside of it, such as
+// comparisons, strings, comments, or unknown names, makes parse() fail.
+//
+//   additive       := multiplicative {('+' | '-') multiplicative}
+//   multiplicative := unary {('*' | '/' | '%') unary}
+//   unary          := '-' unary | power
+//   power          := primary ['^' unary]
+//   primary        := number | variable | constant | call | '(' additive ')'
+
+class program::parser
+{
+public:
+  parser(program& a_program, const std::string& a_text)
+    : m_program(a_program)
+    , m_text(a_text)
+    , m_pos(0)
+  {
+    // empty
+  }
+
+  bool
+  parse()
+  {
+    if (!additive())
+    {
+      return false;
+    }
+    skip();
+    return m_pos == m_text.size();
+  }
+protected:
+  bool
+  additive()
+  {
+    if (!multiplicative())
+    {
+      return false;
+    }
+    while (true)
+    {
+      skip();
+      opcode_type opcode;
+      if (peek() == '+')
+      {
+        opcode = ADD;
+      }
+      else if (peek() == '-' && peek(1) != '-')
+      {
+        opcode = SUBTRACT;
+      }
+      else
+      {
+        return true;
+      }
+      ++m_pos;
+      if (!multiplicative())
+      {
+        return false;
+      }
+      m_program.emit(opcode);
+    }
+  }
+
+  bool
+  multiplicative()
+  {
+    if (!unary())
+    {
+      return false;
+    }
+    while (true)
+    {
+      skip();
+      opcode_type opcode;
+      if (peek() == '*')
+      {
+        opcode = MULTIPLY;
+      }
+      else if (peek() == '/' && peek(1) != '/')
+      {
+        opcode = DIVIDE;
+      }
+      else if (peek() == '%')
+      {
+        opcode = MODULO;
+      }
+      else
+      {
+        return true;
+      }
+      ++m_pos;
+      if (!unary())
+      {
+        return false;
+      }
+      m_program.emit(opcode);
+    }
+  }
+
+  bool
+  unary()
+  {
+    skip();
+    if (peek() == '-')
+    {
+      if (peek(1) == '-')
+      {
+        return false;
+      }
+      ++m_pos;
+      if (!unary())
+      {
+        return false;
+      }
+      m_program.emit(NEGATE);
+      return true;
+    }
+    return power();
+  }
+
+  bool
+  power()
+  {
+    if (!primary())
+    {
+      return false;
+    }
+    skip();
+    if (peek() == '^')
+    {
+      ++m_pos;
+      if (!unary())
+      {
+        return false;
+      }
+      m_program.emit(POWER);
+    }
+    return true;
+  }
+
+  bool
+  primary()
+  {
+    skip();
+    char c = peek();
+    if (c == '(')
+    {
+      ++m_pos;
+      if (!additive())
+      {
+        return false;
+      }
+      skip();
+      return consume(')');
+    }
+    if (is_digit(c) || (c == '.' && is_digit(peek(1))))
+    {
+      return number();
+    }
+    if (is_alpha(c) || c == '_')
+    {
+      return name();
+    }
+    return false;
+  }
+
+  bool
+  number()
+  {
+    if (peek() == '0' && (peek(1) == 'x' || peek(1) == 'X'))
+    {
+      return false;
+    }
+    const char* begin = m_text.c_str() + m_pos;
+    char* end = 0;
+    double value = std::strtod(begin, &end);
+    m_pos += end - begin;
+    if (is_name_character(peek()) || peek() == '.')
+    {
+      return false;
+    }
+    m_program.emit_constant(value);
+    return true;
+  }
+
+  bool
+  name()
+  {
+    std::string name_ = identifier();
+    while (peek() == '.' && (is_alpha(peek(1)) || peek(1) == '_'))
+    {
+      ++m_pos;
+      name_ += "." + identifier();
+    }
+
+    static const char* const variables = "txyzpqr";
+    const char* variable = std::strchr(variables, name_[0]);
+    if (name_.size() == 1 && variable)
+    {
+      m_program.emit_variable(variable - variables);
+      return true;
+    }
+    if (name_ == "math.pi")
+    {
+      m_program.emit_constant(std::acos(-1.0));
+      return true;
+    }
+    if (name_ == "math.huge")
+    {
+      m_program.emit_constant(HUGE_VAL);
+      return true;
+    }
+    return call(name_);
+  }
+
+  // Only the functions of the Lua 5.3 math library are compiled.  Names that
+  // older versions of Lua also provide, such as math.pow or math.sinh, make
+  // parse() fail, so that Lua decides what they mean.
+
+  bool
+  call(const std::string& a_name)
+  {
+    skip();
+    if (!consume('('))
+    {
+      return false;
+    }
+    size_type count = 0;
+    skip();
+    if (peek() != ')')
+    {
+      do
+      {
+        if (!additive())
+        {
+          return false;
+        }
+        ++count;
+        if ((a_name == "math.min" || a_name == "math.max") && count > 1)
+        {
+          m_program.emit(a_name == "math.min" ? MINIMUM : MAXIMUM);
+        }
+        skip();
+      }
+      while (consume(','));
+    }
+    if (!consume(')'))
+    {
+      return false;
+    }
+
+    if (count == 1)
+    {
+      static const struct
+      {
+        const char* name;
+        opcode_type opcode;
+      } functions[] = {
+        {"math.sin", SIN}, {"math.cos", COS}, {"math.tan", TAN},
+        {"math.asin", ASIN}, {"math.acos", ACOS}, {"math.atan", ATAN},
+        {"math.exp", EXP}, {"math.log", LOG}, {"math.sqrt", SQRT},
+        {"math.abs", ABS}, {"math.floor", FLOOR}, {"math.ceil", CEIL}
+      };
+      for (size_type n = 0; n < sizeof(functions) / sizeof(functions[0]); ++n)
+      {
+        if (a_name == functions[n].name)
+        {
+          m_program.emit(functions[n].opcode);
+          return true;
+        }
+      }
+    }
+    if (count == 2)
+    {
+      if (a_name == "math.atan")
+      {
+        m_program.emit(ATAN2);
+        return true;
+      }
+      if (a_name == "math.log")
+      {
+        m_program.emit(LOGARITHM);
+        return true;
+      }
+      if (a_name == "math.fmod")
+      {
+        m_program.emit(FMOD);
+        return true;
+      }
+    }
+    return count > 0 && (a_name == "math.min" || a_name == "math.max");
+  }
+
+  std::string
+  identifier()
+  {
+    size_type begin = m_pos;
+    while (is_name_character(peek()))
+    {
+      ++m_pos;
+    }
+    return m_text.substr(begin, m_pos - begin);
+  }
+
+  bool
+  consume(char a_character)
+  {
+    if (peek() == a_character)
+    {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  void
+  skip()
+  {
+    while (is_space(peek()))
+    {
+      ++m_pos;
+    }
+  }
+
+  char
+  peek(size_type a_offset = 0) const
+  {
+    size_type pos = m_pos + a_offset;
+    return pos < m_text.size() ? m_text[pos] : '\0';
+  }
+
+  static
+  bool
+  is_digit(char a_character)
+  {
+    return std::isdigit(static_cast<unsigned char>(a_character)) != 0;
+  }
+
+  static
+  bool
+  is_alpha(char a_character)
+  {
+    return std::isalpha(static_cast<unsigned char>(a_character)) != 0;
+  }
+
+  static
+  bool
+  is_space(char a_character)
+  {
+    return std::isspace(static_cast<unsigned char>(a_character)) != 0;
+  }
+
+  static
+  bool
+  is_name_character(char a_character)
+  {
+    return is_digit(a_character) || is_alpha(a_character) || a_character == '_';
+  }
+private:
+  program& m_program;
+  const std::string& m_text;
+  size_type m_pos;
+}; // program::parser class
+
+const program::size_type program::max_block_size;
+const program::size_type program::max_depth;
+
+program::program()
+  : m_size(0)
+  , m_depth(0)
+{
+  // empty
+}
+
+program::program(const program& a_other)
+  : m_instructions(a_other.m_instructions)
+  , m_size(a_other.m_size)
+  , m_depth(a_other.m_depth)
+{
+  // empty
+}
+
+program::~program()
+{
+  // empty
+}
+
+program&
+program::operator=(const program& a_other)
+{
+  m_instructions = a_other.m_instructions;
+  m_size = a_other.m_size;
+  m_depth = a_other.m_depth;
+  return *this;
+}
+
+bool
+program::compile(const std::string& a_expression)
+{
+  clear();
+  parser parser_(*this, a_expression);
+  if (!parser_.parse() || m_size != 1 || m_depth > max_depth)
+  {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+void
+program::clear()
+{
+  m_instructions.clear();
+  m_size = 0;
+  m_depth = 0;
+}
+
+bool
+program::empty() const
+{
+  return m_instructions.empty();
+}
+
+program::size_type
+program::get_depth() const
+{
+  return m_depth;
+}
+
+bool
+program::depends_on(variable_type a_variable) const
+{
+  instructions_type::const_iterator p;
+  for (p = m_instructions.begin(); p != m_instructions.end(); ++p)
+  {
+    if (p->opcode == VARIABLE &&
+        p->variable == static_cast<size_type>(a_variable))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+program::run(const double* const a_variables[NUMBER_OF_VARIABLES],
+             size_type a_size,
+             double* a_result) const
+{
+  double stack[max_depth * max_block_size];
+  double* top = stack;
+  instructions_type::const_iterator p;
+  for (p = m_instructions.begin(); p != m_instructions.end(); ++p)
+  {
+    double* x = top - max_block_size;
+    double* y = top - max_block_size;
+    switch (get_arity(p->opcode))
+    {
+    case 0:
+      if (p->opcode == CONSTANT)
+      {
+        std::fill(top, top + a_size, p->value);
+      }
+      else
+      {
+        const double* variable = a_variables[p->variable];
+        std::copy(variable, variable + a_size, top);
+      }
+      top += max_block_size;
+      continue;
+    case 2:
+      x -= max_block_size;
+      top -= max_block_size;
+      break;
+    default:
+      break;
+    }
+
+    switch (p->opcode)
+    {
+    case NEGATE:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] = -x[i];
+      }
+      break;
+    case ADD:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] += y[i];
+      }
+      break;
+    case SUBTRACT:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] -= y[i];
+      }
+      break;
+    case MULTIPLY:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] *= y[i];
+      }
+      break;
+    case DIVIDE:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] /= y[i];
+      }
+      break;
+    default:
+      for (size_type i = 0; i < a_size; ++i)
+      {
+        x[i] = apply(p->opcode, x[i], y[i]);
+      }
+      break;
+    }
+  }
+  std::copy(stack, stack + a_size, a_result);
+}
+
+void
+program::emit(opcode_type a_opcode)
+{
+  // Operations on constants are folded as they are emitted.
+  int arity = get_arity(a_opcode);
+  size_type n = m_instructions.size();
+  if (arity == 1 && n >= 1 && m_instructions[n - 1].opcode == CONSTANT)
+  {
+    double& x = m_instructions[n - 1].value;
+    x = apply(a_opcode, x, 0.0);
+    return;
+  }
+  if (arity == 2 && n >= 2 && m_instructions[n - 2].opcode == CONSTANT
+                           && m_instructions[n - 1].opcode == CONSTANT)
+  {
+    double& x = m_instructions[n - 2].value;
+    x = apply(a_opcode, x, m_instructions[n - 1].value);
+    m_instructions.pop_back();
+    m_size -= 1;
+    return;
+  }
+
+  instruction instruction_ = {a_opcode, 0, 0.0};
+  m_instructions.push_back(instruction_);
+  if (arity == 2)
+  {
+    m_size -= 1;
+  }
+}
+
+void
+program::emit_constant(double a_value)
+{
+  instruction instruction_ = {CONSTANT, 0, a_value};
+  m_instructions.push_back(instruction_);
+  m_depth = std::max(m_depth, ++m_size);
+}
+
+void
+program::emit_variable(size_type a_variable)
+{
+  instruction instruction_ = {VARIABLE, a_variable, 0.0};
+  m_instructions.push_back(instruction_);
+  m_depth = std::max(m_depth, ++m_size);
+}
+
+int
+program::get_arity(opcode_type a_opcode)
+{
+  switch (a_opcode)
+  {
+  case CONSTANT:
+  case VARIABLE:
+    return 0;
+  case ADD:
+  case SUBTRACT:
+  case MULTIPLY:
+  case DIVIDE:
+  case MODULO:
+  case POWER:
+  case MINIMUM:
+  case MAXIMUM:
+  case ATAN2:
+  case FMOD:
+  case LOGARITHM:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+double
+program::apply(opcode_type a_opcode, double a_x, double a_y)
+{
+  double m;
+  switch (a_opcode)
+  {
+  case NEGATE:
+    return -a_x;
+  case ADD:
+    return a_x + a_y;
+  case SUBTRACT:
+    return a_x - a_y;
+  case MULTIPLY:
+    return a_x * a_y;
+  case DIVIDE:
+    return a_x / a_y;
+  case MODULO:
+    // Lua takes the sign of the result from the divisor.
+    m = std::fmod(a_x, a_y);
+    if (m != 0.0 && (m < 0.0) != (a_y < 0.0))
+    {
+      m += a_y;
+    }
+    return m;
+  case POWER:
+    return std::pow(a_x, a_y);
+  case MINIMUM:
+    return a_y < a_x ? a_y : a_x;
+  case MAXIMUM:
+    return a_y > a_x ? a_y : a_x;
+  case ATAN2:
+    return std::atan2(a_x, a_y);
+  case FMOD:
+    return std::fmod(a_x, a_y);
+  case LOGARITHM:
+    if (a_y == 2.0)
+    {
+      return std::log2(a_x);
+    }
+    if (a_y == 10.0)
+    {
+      return std::log10(a_x);
+    }
+    return std::log(a_x) / std::log(a_y);
+  case SIN:
+    return std::sin(a_x);
+  case COS:
+    return std::cos(a_x);
+  case TAN:
+    return std::tan(a_x);
+  case ASIN:
+    return std::asin(a_x);
+  case ACOS:
+    return std::acos(a_x);
+  case ATAN:
+    return std::atan(a_x);
+  case EXP:
+    return std::exp(a_x);
+  case LOG:
+    return std::log(a_x);
+  case SQRT:
+    return std::sqrt(a_x);
+  case ABS:
+    return std::fabs(a_x);
+  case FLOOR:
+    return std::floor(a_x);
+  case CEIL:
+    return std::ceil(a_x);
+  default:
+    return a_x;
+  }
+}
+
+} // evaluator namespace
+} // yamss namespace
@@ -0,0 +1,209 @@
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+#include "yamss/server/publisher.hpp"
+
+namespace yamss {
+namespace server {
+
+namespace {
+
+template <typename T>
+std::string
+to_bytes(const T* a_data, size_t a_size)
+{
+  return std::string(reinterpret_cast<const char*>(a_data), a_size * sizeof(T));
+}
+
+} // anonymous namespace
+
+// A publication is attached to the runner of a job as an inspector, so it
+// sees every step, including those taken by run.  The runner hands
+// inspectors a const structure, but the mode matrices of the loads are built
+// on demand; the publication therefore keeps its own pointer to the
+// structure of the job.
+//
+// The runner calls update() after each step and again when it reports, so
+// a publication remembers the last step it sent and sends each step once.
+
+class publisher::publication : public inspector::inspector<double>
+{
+public:
+  typedef runner<double>::structure_pointer structure_pointer;
+  typedef arma::Mat<double> matrix_type;
+
+  publication(const boost::shared_ptr<publisher>& a_publisher,
+              const JobKey& a_job,
+              size_t a_stride,
+              const std::vector<std::int64_t>& a_loadKeys,
+              const structure_pointer& a_structure)
+    : m_publisher(a_publisher)
+    , m_job(a_job)
+    , m_stride(a_stride)
+    , m_load_keys(a_loadKeys)
+    , m_structure(a_structure)
+    , m_last_step(-1)
+  {
+    // empty
+  }
+
+  virtual
+  void
+  initialize(const eom_type& a_eom,
+             const structure_type& a_structure,
+             const path_type& a_directory)
+  {
+    // empty
+  }
+
+  virtual
+  void
+  update(const eom_type& a_eom, const structure_type& a_structure)
+  {
+    const std::int64_t step = a_eom.get_step(0);
+    boost::shared_ptr<publisher> publisher_ = m_publisher.lock();
+    if (!publisher_ || step % m_stride != 0 || step == m_last_step)
+    {
+      return;
+    }
+    m_last_step = step;
+
+    const double time = a_eom.get_time(0);
+    const arma::Col<double>& q = a_eom.get_displacement(0);
+    const arma::Col<double>& dq = a_eom.get_velocity(0);
+    const arma::Col<double>& ddq = a_eom.get_acceleration(0);
+    const arma::Col<double>& f = a_eom.get_force(0);
+
+    std::vector<std::string> frames;
+    frames.push_back(m_job);
+    frames.push_back("state");
+    frames.push_back(to_bytes(&step, 1));
+    frames.push_back(to_bytes(&time, 1));
+    frames.push_back(to_bytes(q.memptr(), q.n_elem));
+    frames.push_back(to_bytes(dq.memptr(), dq.n_elem));
+    frames.push_back(to_bytes(ddq.memptr(), ddq.n_elem));
+    frames.push_back(to_bytes(f.memptr(), f.n_elem));
+    publisher_->send(frames);
+
+    for (size_t n = 0; n < m_load_keys.size(); ++n)
+    {
+      const matrix_type& modes = m_structure->get_load_modes(m_load_keys[n]);
+      matrix_type state(modes.n_cols, 3);
+      state.col(0) = q;
+      state.col(1) = dq;
+      state.col(2) = ddq;
+      const matrix_type movement = modes * state;
+
+      frames.clear();
+      frames.push_back(m_job);
+      frames.push_back("movement");
+      frames.push_back(to_bytes(&m_load_keys[n], 1));
+      frames.push_back(to_bytes(movement.memptr(), movement.n_elem));
+      publisher_->send(frames);
+    }
+  }
+
+  virtual
+  void
+  finalize(const eom_type& a_eom, const structure_type& a_structure)
+  {
+    // empty
+  }
+private:
+  boost::weak_ptr<publisher> m_publisher;
+  JobKey m_job;
+  size_t m_stride;
+  std::vector<std::int64_t> m_load_keys;
+  structure_pointer m_structure;
+  std::int64_t m_last_step;
+}; // publication class
+
+publisher::publisher(void* a_context, const std::string& a_endpoint)
+  : m_socket(zmq_socket(a_context, ZMQ_PUB))
+  , m_socket_mutex()
+  , m_publications_mutex()
+  , m_publications()
+{
+  if (!m_socket || zmq_bind(m_socket, a_endpoint.c_str()) != 0)
+  {
+    boost::format fmt("Could not bind to %1%");
+    throw std::runtime_error(boost::str(fmt % a_endpoint));
+  }
+}
+
+publisher::~publisher()
+{
+  int linger = 0;
+  zmq_setsockopt(m_socket, ZMQ_LINGER, &linger, sizeof(linger));
+  zmq_close(m_socket);
+}
+
+void
+publisher::publish(handler& a_handler,
+                   const JobKey& a_job,
+                   std::int32_t a_stride,
+                   const std::vector<std::int64_t>& a_loadKeys)
+{
+  handler::runner_lock runner_ = a_handler.get_runner(a_job);
+  publication::structure_pointer structure_ = runner_->get_structure();
+  try
+  {
+    for (size_t n = 0; n < a_loadKeys.size(); ++n)
+    {
+      structure_->get_load(a_loadKeys[n]);
+    }
+  }
+  catch (std::runtime_error& e)
+  {
+    YamssException ye;
+    ye.what = e.what();
+    throw ye;
+  }
+
+  std::lock_guard<std::mutex> lock(m_publications_mutex);
+  publications_type::iterator p = m_publications.begin();
+  while (p != m_publications.end())
+  {
+    if (p->second.expired())
+    {
+      p = m_publications.erase(p);
+    }
+    else
+    {
+      ++p;
+    }
+  }
+
+  p = m_publications.find(a_job);
+  if (p != m_publications.end())
+  {
+    inspector_pointer previous = p->second.lock();
+    if (previous)
+    {
+      runner_->remove_inspector(previous);
+    }
+    m_publications.erase(p);
+  }
+  if (a_stride > 0)
+  {
+    inspector_pointer publication_ = boost::make_shared<publication>(
+        shared_from_this(), a_job, a_stride, a_loadKeys, structure_);
+    runner_->add_inspector(publication_);
+    m_publications[a_job] = publication_;
+  }
+}
+
+void
+publisher::send(const std::vector<std::string>& a_frames)
+{
+  // A PUB socket never blocks; messages for which there is no subscriber,
+  // or that a slow subscriber cannot keep up with, are dropped.
+  std::lock_guard<std::mutex> lock(m_socket_mutex);
+  for (size_t n = 0; n < a_frames.size(); ++n)
+  {
+    int flags = (n + 1 < a_frames.size()) ? ZMQ_SNDMORE : 0;
+    zmq_send(m_socket, a_frames[n].data(), a_frames[n].size(), flags);
+  }
+}
+
+} // server namespace
+} // yamss namespace
@@ -3,6 +3,87 @@
 namespace yamss {
 namespace server {
 
+namespace {
+
+// Clients talk to a ROUTER socket on the public endpoint.  Their requests are
+// passed on by a DEALER socket to a pool of worker threads, each of which runs
+// its own server on a private in-process endpoint.  The servers share one
+// handler, which keeps calls on the same job in order.  The pool runs until
+// the context is shut down.  Only the pool that owns the context shuts it
+// down when it stops; any other pool that fails just reports it, so the rest
+// of the server keeps running.
+
+template <typename Server>
+void
+run_pool(void* a_context,
+         const std::string& a_endpoint,
+         const std::string& a_name,
+         size_t a_workers,
+         bool a_owner,
+         std::function<boost::shared_ptr<Server>(const std::string&)> a_make)
+{
+  std::vector<boost::shared_ptr<Server> > servers;
+  std::vector<std::thread> workers;
+
+  void* frontend = zmq_socket(a_context, ZMQ_ROUTER);
+  void* backend = zmq_socket(a_context, ZMQ_DEALER);
+
+  try
+  {
+    if (zmq_bind(frontend, a_endpoint.c_str()) != 0)
+    {
+      boost::format fmt("Could not bind to %1%");
+      throw std::runtime_error(boost::str(fmt % a_endpoint));
+    }
+
+    // The workers bind their endpoints before the dealer connects to them,
+    // and only then start serving on threads of their own.
+    boost::format model("inproc://yamss-%1%-%2%");
+    for (size_t n = 0; n < a_workers; ++n)
+    {
+      const std::string worker = boost::str(model % a_name % n);
+      servers.push_back(a_make(worker));
+      if (zmq_connect(backend, worker.c_str()) != 0)
+      {
+        boost::format fmt("Could not connect to %1%");
+        throw std::runtime_error(boost::str(fmt % worker));
+      }
+    }
+    for (size_t n = 0; n < a_workers; ++n)
+    {
+      workers.push_back(std::thread([&servers, n]() {
+        try
+        {
+          servers[n]->serve();
+        }
+        catch (std::exception& e)
+        {
+          // The context has been shut down.
+        }
+      }));
+    }
+
+    zmq_proxy(frontend, backend, NULL);
+  }
+  catch (std::exception& e)
+  {
+    std::cout << std::endl << e.what() << std::endl;
+  }
+
+  zmq_close(frontend);
+  zmq_close(backend);
+  if (a_owner)
+  {
+    zmq_ctx_shutdown(a_context);
+  }
+  for (size_t n = 0; n < workers.size(); ++n)
+  {
+    workers[n].join();
+  }
+}
+
+} // anonymous namespace
+
 void
 run_server(const yamss::clp& a_parser)
 {
@@ -23,18 +104,52 @@ run_server(const yamss::clp& a_parser)
   boost::filesystem::create_directories(workdir);
 
   void* context = zmq_ctx_new();
-  const std::string endpoint = a_parser.server_endpoint();
-  server server_(context, endpoint, ZMQ_REP, workdir);
+  const size_t n_workers = a_parser.number_of_workers();
+  shared_ptr<handler> handler_ = boost::make_shared<handler>(workdir);
+  shared_ptr<shared_transport> transport_ =
+      boost::make_shared<shared_transport>();
+  shared_ptr<publisher> publisher_;
+  if (a_parser.publish_mode())
+  {
+    try
+    {
+      publisher_ = boost::make_shared<publisher>(context,
+                                                 a_parser.publish_endpoint());
+    }
+    catch (std::exception& e)
+    {
+      std::cout << std::endl << e.what() << std::endl;
+    }
+  }
 
-  try
+  // Interface data can also be served as raw binary frames on a second
+  // endpoint.  Both pools share the handler, and so the jobs.
+  std::thread binary;
+  if (a_parser.binary_mode())
   {
-    server_.serve();
+    const std::string endpoint = a_parser.binary_endpoint();
+    binary = std::thread([context, endpoint, n_workers, handler_]() {
+      run_pool<binary_server>(context, endpoint, "binary", n_workers, false,
+        [context, handler_](const std::string& a_worker) {
+          return boost::make_shared<binary_server>(context, a_worker, ZMQ_REP,
+                                                   handler_);
+        });
+    });
   }
-  catch (std::exception& e)
+
+  run_pool<server>(context, a_parser.server_endpoint(), "worker", n_workers,
+                   true,
+    [context, handler_, publisher_, transport_](const std::string& a_worker) {
+      return boost::make_shared<server>(context, a_worker, ZMQ_REP, handler_,
+                                        publisher_, transport_);
+    });
+  if (binary.joinable())
   {
-    std::cout << std::endl << e.what() << std::endl;
+    binary.join();
   }
 
+  transport_.reset();
+  publisher_.reset();
   zmq_ctx_term(context);
   if (!a_parser.keep_files())
   {
@@ -1,3 +1,4 @@
+#include <utility>
 #include "yamss/server/server.hpp"
 
 namespace yamss {
@@ -8,7 +9,23 @@ server::server(void* a_context,
                  int a_type,
                  const boost::filesystem::path& a_directory)
   : Yamss::server(a_context, a_endpoint, a_type)
-  , m_handler(a_directory)
+  , m_handler(boost::make_shared<handler>(a_directory))
+  , m_publisher()
+  , m_transport()
+{
+  // empty
+}
+
+server::server(void* a_context,
+               const std::string& a_endpoint,
+               int a_type,
+               const boost::shared_ptr<handler>& a_handler,
+               const boost::shared_ptr<publisher>& a_publisher,
+               const boost::shared_ptr<shared_transport>& a_transport)
+  : Yamss::server(a_context, a_endpoint, a_type)
+  , m_handler(a_handler)
+  , m_publisher(a_publisher)
+  , m_transport(a_transport)
 {
   // empty
 }
@@ -16,125 +33,158 @@ server::server(void* a_context,
 void
 server::advance(const JobKey& a_job)
 {
-  m_handler.advance(a_job);
+  m_handler->advance(a_job);
 }
 
 JobKey
 server::create(const std::string& a_url)
 {
-  return m_handler.create(a_url);
+  return m_handler->create(a_url);
+}
+
+std::vector<InterfaceMovement>
+server::exchange(const JobKey& a_job,
+                 const std::vector<std::int64_t>& a_loadKeys,
+                 const std::vector<InterfaceLoading>& a_loadings,
+                 const bool a_subiterate,
+                 const std::vector<std::int64_t>& a_movementKeys)
+{
+  typedef std::vector<yamss::InterfaceLoading> loadings_type;
+  const auto& loadings =
+      *reinterpret_cast<const loadings_type*>(&a_loadings);
+  auto r = m_handler->exchange(a_job, a_loadKeys, loadings, a_subiterate,
+                               a_movementKeys);
+  return std::move(*reinterpret_cast<std::vector<InterfaceMovement>*>(&r));
 }
 
 void
 server::finalize(const JobKey& a_job)
 {
-  m_handler.finalize(a_job);
+  m_handler->finalize(a_job);
 }
 
 std::vector<bool>
 server::getActiveDofs(const JobKey& a_job)
 {
-  return m_handler.getActiveDofs(a_job);
+  return m_handler->getActiveDofs(a_job);
 }
 
 double
 server::getFinalTime(const JobKey& a_job)
 {
-  return m_handler.getFinalTime(a_job);
+  return m_handler->getFinalTime(a_job);
 }
 
 InterfacePatch
 server::getInterface(const JobKey& a_job, const std::int64_t a_loadKey)
 {
-  auto r = m_handler.getInterface(a_job, a_loadKey);
-  return *reinterpret_cast<InterfacePatch*>(&r);
+  auto r = m_handler->getInterface(a_job, a_loadKey);
+  return std::move(*reinterpret_cast<InterfacePatch*>(&r));
 }
 
 InterfaceMovement
 server::getMovement(const JobKey& a_job, const int64_t a_loadKey)
 {
-  auto r = m_handler.getMovement(a_job, a_loadKey);
-  return *reinterpret_cast<InterfaceMovement*>(&r);
+  auto r = m_handler->getMovement(a_job, a_loadKey);
+  return std::move(*reinterpret_cast<InterfaceMovement*>(&r));
 }
 
 std::vector<double>
 server::getModes(const JobKey& a_job)
 {
-  return m_handler.getModes(a_job);
+  return m_handler->getModes(a_job);
 }
 
 Node
 server::getNode(const JobKey& a_job, const int64_t a_nodeKey)
 {
-  auto r = m_handler.getNode(a_job, a_nodeKey);
-  return *reinterpret_cast<Node*>(&r);
+  auto r = m_handler->getNode(a_job, a_nodeKey);
+  return std::move(*reinterpret_cast<Node*>(&r));
 }
 
 std::int32_t
 server::getNumberOfActiveDofs(const JobKey& a_job)
 {
-  return m_handler.getNumberOfActiveDofs(a_job);
+  return m_handler->getNumberOfActiveDofs(a_job);
 }
 
 std::int32_t
 server::getNumberOfNodes(const JobKey& a_job)
 {
-  return m_handler.getNumberOfNodes(a_job);
+  return m_handler->getNumberOfNodes(a_job);
 }
 
 State
 server::getState(const JobKey& a_job)
 {
-  auto r = m_handler.getState(a_job);
-  return *reinterpret_cast<State*>(&r);
+  auto r = m_handler->getState(a_job);
+  return std::move(*reinterpret_cast<State*>(&r));
 }
 
 double
 server::getTime(const JobKey& a_job)
 {
-  return m_handler.getTime(a_job);
+  return m_handler->getTime(a_job);
 }
 
 double
 server::getTimeStep(const JobKey& a_job)
 {
-  return m_handler.getTimeStep(a_job);
+  return m_handler->getTimeStep(a_job);
 }
 
 void
 server::initialize(const JobKey& a_job)
 {
-  m_handler.initialize(a_job);
+  m_handler->initialize(a_job);
+}
+
+void
+server::publish(const JobKey& a_job,
+                const std::int32_t a_stride,
+                const std::vector<std::int64_t>& a_loadKeys)
+{
+  if (!m_publisher)
+  {
+    yamss::YamssException ye;
+    ye.what = "The server was not started with a publication endpoint";
+    throw ye;
+  }
+  m_publisher->publish(*m_handler, a_job, a_stride, a_loadKeys);
 }
 
 void
 server::release(const JobKey& a_job)
 {
-  m_handler.release(a_job);
+  if (m_transport)
+  {
+    m_transport->unshare(a_job);
+  }
+  m_handler->release(a_job);
 }
 
 void
 server::report(const JobKey& a_job)
 {
-  m_handler.report(a_job);
+  m_handler->report(a_job);
 }
 
 void
 server::run(const JobKey& a_job)
 {
-  m_handler.run(a_job);
+  m_handler->run(a_job);
 }
 
 void
 server::runJob(const std::string& a_url)
 {
-  m_handler.runJob(a_url);
+  m_handler->runJob(a_url);
 }
 
 void
 server::setFinalTime(const JobKey& a_job, const double a_final_time)
 {
-  m_handler.setFinalTime(a_job, a_final_time);
+  m_handler->setFinalTime(a_job, a_final_time);
 }
 
 void
@@ -142,26 +192,48 @@ server::setLoading(const JobKey& a_job,
                    const int64_t a_load,
                    const InterfaceLoading& a_loading)
 {
-  auto loading = *reinterpret_cast<const yamss::InterfaceLoading*>(&a_loading);
-  m_handler.setLoading(a_job, a_load, loading);
+  const auto& loading =
+      *reinterpret_cast<const yamss::InterfaceLoading*>(&a_loading);
+  m_handler->setLoading(a_job, a_load, loading);
+}
+
+std::string
+server::share(const JobKey& a_job, const std::vector<std::int64_t>& a_loadKeys)
+{
+  if (!m_transport)
+  {
+    yamss::YamssException ye;
+    ye.what = "The server was not started with a shared memory transport";
+    throw ye;
+  }
+  return m_transport->share(m_handler, a_job, a_loadKeys);
 }
 
 void
 server::step(const JobKey& a_job)
 {
-  m_handler.step(a_job);
+  m_handler->step(a_job);
 }
 
 void
 server::stepN(const JobKey& a_job, const std::int32_t a_steps)
 {
-  m_handler.stepN(a_job, a_steps);
+  m_handler->stepN(a_job, a_steps);
 }
 
 void
 server::subiterate(const JobKey& a_job)
 {
-  m_handler.subiterate(a_job);
+  m_handler->subiterate(a_job);
+}
+
+void
+server::unshare(const JobKey& a_job)
+{
+  if (m_transport)
+  {
+    m_transport->unshare(a_job);
+  }
 }
 
 } // server namespace
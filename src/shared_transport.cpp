@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include "yamss/server/shared_transport.hpp"
+
+namespace yamss {
+namespace server {
+
+// A channel owns the regions of one shared job and the thread that serves
+// them.  Destroying the channel stops the thread and removes the regions.
+
+class shared_transport::channel
+{
+public:
+  typedef handler::matrix_type matrix_type;
+
+  channel(const boost::shared_ptr<handler>& a_handler,
+          const JobKey& a_job,
+          const std::vector<std::int64_t>& a_loadKeys)
+    : m_handler(a_handler)
+    , m_job(a_job)
+    , m_load_keys(a_loadKeys)
+    , m_control()
+    , m_loads(a_loadKeys.size())
+    , m_stop(false)
+    , m_thread()
+  {
+    std::vector<size_t> n_pressures(m_load_keys.size());
+    std::vector<size_t> n_rows(m_load_keys.size());
+    {
+      handler::runner_lock runner_ = m_handler->get_runner(m_job);
+      handler::runner_type::structure_pointer structure_ =
+          runner_->get_structure();
+      try
+      {
+        for (size_t n = 0; n < m_load_keys.size(); ++n)
+        {
+          n_pressures[n] = structure_->get_load(m_load_keys[n])
+                                     .get_number_of_nodes();
+          n_rows[n] = structure_->get_load_modes(m_load_keys[n]).n_rows;
+        }
+      }
+      catch (std::runtime_error& e)
+      {
+        YamssException ye;
+        ye.what = e.what();
+        throw ye;
+      }
+    }
+
+    try
+    {
+      m_control.create(get_shared_name(m_job), sizeof(shared_control));
+      shared_control* control =
+          new (m_control.get_address()) shared_control();
+      control->number_of_loads = m_load_keys.size();
+
+      for (size_t n = 0; n < m_load_keys.size(); ++n)
+      {
+        m_loads[n].create(get_shared_name(m_job, m_load_keys[n]),
+                          shared_load::get_region_size(n_pressures[n],
+                                                       n_rows[n]));
+        shared_load* load = new (m_loads[n].get_address()) shared_load();
+        load->key = m_load_keys[n];
+        load->number_of_pressures = n_pressures[n];
+        load->number_of_rows = n_rows[n];
+        load->magic = shared_load::magic_number;
+      }
+      control->magic = shared_control::magic_number;
+    }
+    catch (std::runtime_error& e)
+    {
+      YamssException ye;
+      ye.what = e.what();
+      throw ye;
+    }
+
+    m_thread = std::thread(&channel::serve, this);
+  }
+
+  // Once the thread has stopped, a request that is still waiting is failed
+  // and the client is told that the job is closed.
+
+  ~channel()
+  {
+    m_stop = true;
+    m_thread.join();
+
+    shared_control& control = get_control();
+    control.closed.store(1, std::memory_order_release);
+    const std::uint32_t request =
+        control.request.load(std::memory_order_acquire);
+    if (control.reply.load(std::memory_order_relaxed) != request)
+    {
+      fail(control, "The job is no longer shared");
+      control.reply.store(request, std::memory_order_release);
+    }
+    wake_all(control.reply);
+  }
+
+  const std::string&
+  get_name() const
+  {
+    return m_control.get_name();
+  }
+protected:
+  shared_control&
+  get_control()
+  {
+    return *static_cast<shared_control*>(m_control.get_address());
+  }
+
+  shared_load&
+  get_load(size_t a_load)
+  {
+    return *static_cast<shared_load*>(m_loads[a_load].get_address());
+  }
+
+  // Wait for requests until the channel is destroyed.  The timeout only
+  // bounds how long the destructor waits for the thread.
+
+  void
+  serve()
+  {
+    // The region is published before the thread starts, so a client may
+    // already have made a request; count from the initial value instead of
+    // reading the counter.
+    shared_control& control = get_control();
+    std::uint32_t served = 0;
+    while (!m_stop)
+    {
+      if (!wait_for_change(control.request, served,
+                           std::chrono::milliseconds(100)))
+      {
+        continue;
+      }
+      served = control.request.load(std::memory_order_acquire);
+      exchange(control);
+      control.reply.store(served, std::memory_order_release);
+      wake_all(control.reply);
+    }
+  }
+
+  void
+  exchange(shared_control& a_control)
+  {
+    a_control.status = 0;
+    a_control.message[0] = '\0';
+    try
+    {
+      handler::runner_lock runner_ = m_handler->get_runner(m_job);
+      for (size_t n = 0; n < m_loads.size(); ++n)
+      {
+        shared_load& load = get_load(n);
+        m_handler->set_loading(*runner_, load.key, load.get_pressures(),
+                               load.number_of_pressures);
+      }
+
+      try
+      {
+        if (a_control.subiterate)
+        {
+          runner_->subiterate();
+        }
+        else
+        {
+          runner_->step();
+        }
+      }
+      catch (std::exception& e)
+      {
+        boost::format fmt("Failed to step the job %1%");
+        fail(a_control, boost::str(fmt % m_job));
+        return;
+      }
+
+      // The product that yields the movement is written straight into the
+      // region.
+      for (size_t n = 0; n < m_loads.size(); ++n)
+      {
+        shared_load& load = get_load(n);
+        matrix_type movement(load.get_movement(), load.number_of_rows, 3,
+                             false, true);
+        m_handler->get_movement(*runner_, load.key, movement);
+      }
+    }
+    catch (YamssException& e)
+    {
+      fail(a_control, e.what);
+    }
+    catch (std::exception& e)
+    {
+      fail(a_control, e.what());
+    }
+  }
+
+  void
+  fail(shared_control& a_control, const std::string& a_what)
+  {
+    const size_t size = std::min(a_what.size(), sizeof(a_control.message) - 1);
+    a_what.copy(a_control.message, size);
+    a_control.message[size] = '\0';
+    a_control.status = 1;
+  }
+private:
+  boost::shared_ptr<handler> m_handler;
+  JobKey m_job;
+  std::vector<std::int64_t> m_load_keys;
+  shared_region m_control;
+  std::vector<shared_region> m_loads;
+  std::atomic<bool> m_stop;
+  std::thread m_thread;
+}; // channel class
+
+shared_transport::shared_transport()
+  : m_channels_mutex()
+  , m_channels()
+{
+  // empty
+}
+
+shared_transport::~shared_transport()
+{
+  // The channels stop their threads and remove their regions.
+}
+
+std::string
+shared_transport::share(const boost::shared_ptr<handler>& a_handler,
+                        const JobKey& a_job,
+                        const std::vector<std::int64_t>& a_loadKeys)
+{
+  std::lock_guard<std::mutex> lock(m_channels_mutex);
+  m_channels.erase(a_job);
+  channel_pointer channel_ =
+      boost::make_shared<channel>(a_handler, a_job, a_loadKeys);
+  m_channels[a_job] = channel_;
+  return channel_->get_name();
+}
+
+void
+shared_transport::unshare(const JobKey& a_job)
+{
+  std::lock_guard<std::mutex> lock(m_channels_mutex);
+  m_channels.erase(a_job);
+}
+
+} // server namespace
+} // yamss namespace
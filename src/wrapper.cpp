@@ -15,6 +15,17 @@ create(const std::string& a_url) throw(YamssException)
   return this_handler::get()->create(a_url);
 }
 
+std::vector<InterfaceMovement>
+exchange(const JobKey& a_job,
+         const std::vector<std::int64_t>& a_loadKeys,
+         const std::vector<InterfaceLoading>& a_loadings,
+         const bool a_subiterate,
+         const std::vector<std::int64_t>& a_movementKeys) throw(YamssException)
+{
+  return this_handler::get()->exchange(a_job, a_loadKeys, a_loadings,
+                                       a_subiterate, a_movementKeys);
+}
+
 void
 finalize(const JobKey& a_job) throw(YamssException)
 {
@@ -2,6 +2,7 @@
 #define YAMSS_CLP_HPP
 
 #include <iostream>
+#include <thread>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include "yamss/about.hpp"
@@ -52,6 +53,21 @@ public:
   std::string
   server_endpoint() const;
 
+  size_t
+  number_of_workers() const;
+
+  bool
+  binary_mode() const;
+
+  std::string
+  binary_endpoint() const;
+
+  bool
+  publish_mode() const;
+
+  std::string
+  publish_endpoint() const;
+
 #endif // YAMSS_SUPPORTS_SERVER_MODE
 
 protected:
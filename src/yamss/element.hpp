@@ -1,10 +1,17 @@
 #ifndef YAMSS_ELEMENT_HPP
 #define YAMSS_ELEMENT_HPP
 
+#include <vector>
 #include <armadillo>
+#include <boost/unordered_map.hpp>
 
 namespace yamss {
 
+class element_storage;
+
+// An element is a lightweight view of one entry of an element_storage.  It
+// remains valid for as long as the storage exists.
+
 class element
 {
 public:
@@ -20,7 +27,7 @@ public:
     QUADRILATERAL
   };
 
-  element(key_type a_key, shape_type a_shape);
+  element(element_storage& a_storage, size_type a_index);
 
   element(const element& a_other);
 
@@ -32,6 +39,9 @@ public:
   key_type
   get_key() const;
 
+  size_type
+  get_index() const;
+
   shape_type
   get_shape() const;
 
@@ -41,7 +51,10 @@ public:
   key_type
   get_vertex(size_type a_pos) const;
 
-  const vector_type&
+  size_type
+  get_vertex_index(size_type a_pos) const;
+
+  vector_type
   get_vertices() const;
 
   void
@@ -49,17 +62,114 @@ public:
 
   void
   set_vertices(const vector_type& a_vertices);
-protected:
-  void
-  set_shape(shape_type a_shape);
+
+  static
+  size_type
+  get_size(shape_type a_shape);
 private:
   element();
 
-  key_type m_key;
-  shape_type m_shape;
-  vector_type m_vertices;
+  element_storage* m_storage;
+  size_type m_index;
 }; // element class
 
+// The connectivity of all of the elements of a structure is stored in
+// compressed sparse row form.  The vertices of element e are the nodes with
+// the dense indices get_vertices()[get_offsets()[e]] up to, but excluding,
+// get_vertices()[get_offsets()[e + 1]], or no_vertex where a vertex has not
+// been set.  Node keys are translated through the key and index tables of
+// the structure that owns the storage.
+
+class element_storage
+{
+public:
+  typedef size_t key_type;
+  typedef size_t size_type;
+  typedef element::shape_type shape_type;
+  typedef std::vector<key_type> keys_type;
+  typedef boost::unordered_map<key_type, size_type> indices_type;
+
+  // The vertex index of a vertex that has not been set yet.
+
+  static const size_type no_vertex = static_cast<size_type>(-1);
+
+  element_storage(const keys_type& a_node_keys,
+                  const indices_type& a_node_indices);
+
+  ~element_storage();
+
+  size_type
+  get_size() const;
+
+  // Add an element and return its index.  Adding an element whose key is
+  // already taken throws.  The vertices start out as no_vertex, and the
+  // element must not be used until all of them have been set.
+
+  size_type
+  add(key_type a_key, shape_type a_shape);
+
+  bool
+  find(key_type a_key, size_type& a_index) const;
+
+  key_type
+  get_key(size_type a_index) const;
+
+  shape_type
+  get_shape(size_type a_index) const;
+
+  size_type
+  get_number_of_vertices(size_type a_index) const;
+
+  size_type
+  get_vertex_index(size_type a_index, size_type a_pos) const;
+
+  key_type
+  get_vertex_key(size_type a_index, size_type a_pos) const;
+
+  void
+  set_vertex(size_type a_index, size_type a_pos, key_type a_vertex);
+
+  // Replace each vertex index n by a_new_indices[n], after the nodes have
+  // been renumbered.  Vertices that have not been set are left alone.
+
+  void
+  renumber_nodes(const std::vector<size_type>& a_new_indices);
+
+  // Rearrange the elements so that the element at index a_order[i] moves to
+  // index i.
+
+  void
+  permute(const std::vector<size_type>& a_order);
+
+  const std::vector<size_type>&
+  get_offsets() const;
+
+  const std::vector<size_type>&
+  get_vertices() const;
+
+  const std::vector<shape_type>&
+  get_shapes() const;
+
+  // The version changes whenever a vertex is set or an element is added.
+
+  size_type
+  get_version() const;
+private:
+  element_storage(const element_storage& a_other);
+
+  element_storage&
+  operator=(const element_storage& a_other);
+
+  const keys_type* m_node_keys;
+  const indices_type* m_node_indices;
+  keys_type m_keys;
+  indices_type m_indices;
+  std::vector<shape_type> m_shapes;
+  std::vector<size_type> m_offsets;
+  std::vector<size_type> m_vertices;
+  size_type m_version;
+}; // element_storage class
+
 } // yamss namespace
 
 #endif // YAMSS_ELEMENT_HPP
@@ -1,8 +1,12 @@
 #ifndef YAMSS_EOM_HPP
 #define YAMSS_EOM_HPP
 
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 #include <armadillo>
+#include <boost/format.hpp>
+#include "yamss/factorization.hpp"
 #include "yamss/iterate.hpp"
 
 namespace yamss {
@@ -16,23 +20,78 @@ public:
   typedef const T& const_reference;
   typedef arma::Col<T> vector_type;
   typedef arma::Mat<T> matrix_type;
-
-  eom(size_type a_dofs, size_type a_steps)
-    : m_mass(a_dofs, a_dofs)
-    , m_damping(a_dofs, a_dofs)
-    , m_stiffness(a_dofs, a_dofs)
+  typedef arma::SpMat<T> sparse_matrix_type;
+
+  // Dense storage keeps full m x m matrices.  Diagonal storage keeps only
+  // the diagonals, and sparse storage only the nonzero entries; dense copies
+  // are built on request in both cases.
+
+  enum storage_type
+  {
+    DENSE,
+    DIAGONAL,
+    SPARSE
+  };
+
+  eom(size_type a_dofs, size_type a_steps, storage_type a_storage = DENSE)
+    : m_size(a_dofs)
+    , m_diagonal_storage(a_storage == DIAGONAL)
+    , m_sparse_storage(a_storage == SPARSE)
+    , m_mass()
+    , m_damping()
+    , m_stiffness()
+    , m_mass_diagonal(a_dofs)
+    , m_damping_diagonal(a_dofs)
+    , m_stiffness_diagonal(a_dofs)
     , m_iterates(a_steps, iterate_type(a_dofs))
-  {
-    m_mass.eye();
-    m_damping.zeros();
-    m_stiffness.eye();
+    , m_current(0)
+    , m_work()
+    , m_mass_factorization()
+    , m_version(0)
+    , m_detected_version(0)
+    , m_materialized_version(0)
+    , m_factorized_version(0)
+    , m_diagonal(true)
+  {
+    m_mass_diagonal.ones();
+    m_damping_diagonal.zeros();
+    m_stiffness_diagonal.ones();
+    if (m_sparse_storage)
+    {
+      m_sparse_mass = arma::speye<sparse_matrix_type>(a_dofs, a_dofs);
+      m_sparse_damping.zeros(a_dofs, a_dofs);
+      m_sparse_stiffness = arma::speye<sparse_matrix_type>(a_dofs, a_dofs);
+    }
+    else if (!m_diagonal_storage)
+    {
+      m_mass = arma::diagmat(m_mass_diagonal);
+      m_damping = arma::diagmat(m_damping_diagonal);
+      m_stiffness = arma::diagmat(m_stiffness_diagonal);
+    }
   }
 
   eom(const eom& a_other)
-    : m_mass(a_other.m_mass)
+    : m_size(a_other.m_size)
+    , m_diagonal_storage(a_other.m_diagonal_storage)
+    , m_sparse_storage(a_other.m_sparse_storage)
+    , m_mass(a_other.m_mass)
     , m_damping(a_other.m_damping)
     , m_stiffness(a_other.m_stiffness)
+    , m_mass_diagonal(a_other.m_mass_diagonal)
+    , m_damping_diagonal(a_other.m_damping_diagonal)
+    , m_stiffness_diagonal(a_other.m_stiffness_diagonal)
+    , m_sparse_mass(a_other.m_sparse_mass)
+    , m_sparse_damping(a_other.m_sparse_damping)
+    , m_sparse_stiffness(a_other.m_sparse_stiffness)
     , m_iterates(a_other.m_iterates)
+    , m_current(a_other.m_current)
+    , m_work()
+    , m_mass_factorization()
+    , m_version(a_other.m_version)
+    , m_detected_version(a_other.m_detected_version)
+    , m_materialized_version(a_other.m_materialized_version)
+    , m_factorized_version(0)
+    , m_diagonal(a_other.m_diagonal)
   {
     // empty
   }
@@ -45,199 +104,365 @@ public:
   eom&
   operator=(const eom& a_other)
   {
+    m_size = a_other.m_size;
+    m_diagonal_storage = a_other.m_diagonal_storage;
+    m_sparse_storage = a_other.m_sparse_storage;
     m_mass = a_other.m_mass;
     m_damping = a_other.m_damping;
     m_stiffness = a_other.m_stiffness;
+    m_mass_diagonal = a_other.m_mass_diagonal;
+    m_damping_diagonal = a_other.m_damping_diagonal;
+    m_stiffness_diagonal = a_other.m_stiffness_diagonal;
+    m_sparse_mass = a_other.m_sparse_mass;
+    m_sparse_damping = a_other.m_sparse_damping;
+    m_sparse_stiffness = a_other.m_sparse_stiffness;
     m_iterates = a_other.m_iterates;
+    m_current = a_other.m_current;
+    m_version = a_other.m_version;
+    m_detected_version = a_other.m_detected_version;
+    m_materialized_version = a_other.m_materialized_version;
+    m_mass_factorization.reset();
+    m_diagonal = a_other.m_diagonal;
     return *this;
   }
 
   size_type
   get_size() const
   {
-    return m_mass.n_rows;
+    return m_size;
+  }
+
+  size_type
+  get_version() const
+  {
+    return m_version;
+  }
+
+  bool
+  has_diagonal_storage() const
+  {
+    return m_diagonal_storage;
+  }
+
+  bool
+  has_sparse_storage() const
+  {
+    return m_sparse_storage;
+  }
+
+  bool
+  is_diagonal() const
+  {
+    detect_diagonal();
+    return m_diagonal;
   }
 
   const matrix_type&
   get_mass() const
   {
+    materialize();
     return m_mass;
   }
 
   const matrix_type&
   get_damping() const
   {
+    materialize();
     return m_damping;
   }
 
   const matrix_type&
   get_stiffness() const
   {
+    materialize();
     return m_stiffness;
   }
 
+  // The sparse matrices are only available with sparse storage.
+
+  const sparse_matrix_type&
+  get_sparse_mass() const
+  {
+    return m_sparse_mass;
+  }
+
+  const sparse_matrix_type&
+  get_sparse_damping() const
+  {
+    return m_sparse_damping;
+  }
+
+  const sparse_matrix_type&
+  get_sparse_stiffness() const
+  {
+    return m_sparse_stiffness;
+  }
+
+  const vector_type&
+  get_mass_diagonal() const
+  {
+    detect_diagonal();
+    return m_mass_diagonal;
+  }
+
+  const vector_type&
+  get_damping_diagonal() const
+  {
+    detect_diagonal();
+    return m_damping_diagonal;
+  }
+
+  const vector_type&
+  get_stiffness_diagonal() const
+  {
+    detect_diagonal();
+    return m_stiffness_diagonal;
+  }
+
   size_type
   get_step(size_type a_step) const
   {
-    return m_iterates[a_step].get_step();
+    return get_iterate(a_step).get_step();
   }
 
   const_reference
   get_time(size_type a_step) const
   {
-    return m_iterates[a_step].get_time();
+    return get_iterate(a_step).get_time();
   }
 
   const_reference
   get_time_step(size_type a_step) const
   {
-    return m_iterates[a_step].get_time_step();
+    return get_iterate(a_step).get_time_step();
   }
 
   const vector_type&
   get_displacement(size_type a_step) const
   {
-    return m_iterates[a_step].get_displacement();
+    return get_iterate(a_step).get_displacement();
   }
 
   const vector_type&
   get_velocity(size_type a_step) const
   {
-    return m_iterates[a_step].get_velocity();
+    return get_iterate(a_step).get_velocity();
   }
 
   const vector_type&
   get_acceleration(size_type a_step) const
   {
-    return m_iterates[a_step].get_acceleration();
+    return get_iterate(a_step).get_acceleration();
   }
 
   const vector_type&
   get_force(size_type a_step) const
   {
-    return m_iterates[a_step].get_force();
+    return get_iterate(a_step).get_force();
   }
 
   void
   set_mass(const matrix_type& a_mass)
   {
-    m_mass = a_mass;
+    set_matrix(m_mass, m_sparse_mass, m_mass_diagonal, a_mass, "mass");
+  }
+
+  void
+  set_mass(const sparse_matrix_type& a_mass)
+  {
+    set_matrix(m_mass, m_sparse_mass, m_mass_diagonal, a_mass, "mass");
   }
 
   void
   set_mass(size_type a_row, size_type a_col, const_reference a_value)
   {
-    m_mass(a_row, a_col) = a_value;
+    set_entry(m_mass, m_sparse_mass, m_mass_diagonal,
+              a_row, a_col, a_value, "mass");
+  }
+
+  void
+  set_mass_diagonal(const vector_type& a_mass)
+  {
+    set_diagonal(m_mass, m_sparse_mass, m_mass_diagonal, a_mass, "mass");
   }
 
   void
   set_damping(const matrix_type& a_damping)
   {
-    m_damping = a_damping;
+    set_matrix(m_damping, m_sparse_damping, m_damping_diagonal,
+               a_damping, "damping");
+  }
+
+  void
+  set_damping(const sparse_matrix_type& a_damping)
+  {
+    set_matrix(m_damping, m_sparse_damping, m_damping_diagonal,
+               a_damping, "damping");
   }
 
   void
   set_damping(size_type a_row, size_type a_col, const_reference a_value)
   {
-    m_damping(a_row, a_col) = a_value;
+    set_entry(m_damping, m_sparse_damping, m_damping_diagonal,
+              a_row, a_col, a_value, "damping");
+  }
+
+  void
+  set_damping_diagonal(const vector_type& a_damping)
+  {
+    set_diagonal(m_damping, m_sparse_damping, m_damping_diagonal,
+                 a_damping, "damping");
   }
 
   void
   set_stiffness(const matrix_type& a_stiffness)
   {
-    m_stiffness = a_stiffness;
+    set_matrix(m_stiffness, m_sparse_stiffness, m_stiffness_diagonal,
+               a_stiffness, "stiffness");
+  }
+
+  void
+  set_stiffness(const sparse_matrix_type& a_stiffness)
+  {
+    set_matrix(m_stiffness, m_sparse_stiffness, m_stiffness_diagonal,
+               a_stiffness, "stiffness");
   }
 
   void
   set_stiffness(size_type a_row, size_type a_col, const_reference a_value)
   {
-    m_stiffness(a_row, a_col) = a_value;
+    set_entry(m_stiffness, m_sparse_stiffness, m_stiffness_diagonal,
+              a_row, a_col, a_value, "stiffness");
+  }
+
+  void
+  set_stiffness_diagonal(const vector_type& a_stiffness)
+  {
+    set_diagonal(m_stiffness, m_sparse_stiffness, m_stiffness_diagonal,
+                 a_stiffness, "stiffness");
   }
 
   void
   set_displacement(const vector_type& a_displacement)
   {
-    m_iterates[0].set_displacement(a_displacement);
+    get_iterate(0).set_displacement(a_displacement);
   }
 
   void
   set_displacement(size_type a_dof, const_reference a_value)
   {
-    m_iterates[0].set_displacement(a_dof, a_value);
+    get_iterate(0).set_displacement(a_dof, a_value);
   }
 
   void
   set_velocity(const vector_type& a_velocity)
   {
-    m_iterates[0].set_velocity(a_velocity);
+    get_iterate(0).set_velocity(a_velocity);
   }
 
   void
   set_velocity(size_type a_dof, const_reference a_value)
   {
-    m_iterates[0].set_velocity(a_dof, a_value);
+    get_iterate(0).set_velocity(a_dof, a_value);
   }
 
   void
   set_acceleration(const vector_type& a_acceleration)
   {
-    m_iterates[0].set_acceleration(a_acceleration);
+    get_iterate(0).set_acceleration(a_acceleration);
   }
 
   void
   set_acceleration(size_type a_dof, const_reference a_value)
   {
-    m_iterates[0].set_acceleration(a_dof, a_value);
+    get_iterate(0).set_acceleration(a_dof, a_value);
   }
 
   void
   set_force(const vector_type& a_force)
   {
-    m_iterates[0].set_force(a_force);
+    get_iterate(0).set_force(a_force);
   }
 
   void
   set_force(size_type a_dof, const_reference a_value)
   {
-    m_iterates[0].set_force(a_dof, a_value);
+    get_iterate(0).set_force(a_dof, a_value);
   }
 
   void
   compute_acceleration()
   {
+    if (is_diagonal())
+    {
+      get_iterate(0).set_acceleration((get_iterate(0).get_force()
+          - m_damping_diagonal % get_iterate(0).get_velocity()
+          - m_stiffness_diagonal % get_iterate(0).get_displacement())
+          / m_mass_diagonal);
+      return;
+    }
     vector_type lhs;
-    vector_type rhs = m_iterates[0].get_force()
-        - m_damping * m_iterates[0].get_velocity()
-        - m_stiffness * m_iterates[0].get_displacement();
+    if (m_sparse_storage)
+    {
+      vector_type rhs = get_iterate(0).get_force()
+          - m_sparse_damping * get_iterate(0).get_velocity()
+          - m_sparse_stiffness * get_iterate(0).get_displacement();
+      factorize_mass();
+      m_mass_factorization.solve(lhs, rhs);
+      get_iterate(0).set_acceleration(lhs);
+      return;
+    }
+    vector_type rhs = get_iterate(0).get_force()
+        - m_damping * get_iterate(0).get_velocity()
+        - m_stiffness * get_iterate(0).get_displacement();
     arma::solve(lhs, m_mass, rhs);
-    m_iterates[0].set_acceleration(lhs);
+    get_iterate(0).set_acceleration(lhs);
   }
 
   void
   compute_force()
   {
-    vector_type f = m_mass * m_iterates[0].get_acceleration()
-        + m_damping * m_iterates[0].get_velocity()
-        + m_stiffness * m_iterates[0].get_displacement();
-    m_iterates[0].set_force(f);
+    if (is_diagonal())
+    {
+      m_work = m_mass_diagonal % get_iterate(0).get_acceleration()
+          + m_damping_diagonal % get_iterate(0).get_velocity()
+          + m_stiffness_diagonal % get_iterate(0).get_displacement();
+      get_iterate(0).set_force(m_work);
+      return;
+    }
+    if (m_sparse_storage)
+    {
+      m_work = m_sparse_mass * get_iterate(0).get_acceleration();
+      m_work += m_sparse_damping * get_iterate(0).get_velocity();
+      m_work += m_sparse_stiffness * get_iterate(0).get_displacement();
+      get_iterate(0).set_force(m_work);
+      return;
+    }
+    m_work = m_mass * get_iterate(0).get_acceleration();
+    m_work += m_damping * get_iterate(0).get_velocity();
+    m_work += m_stiffness * get_iterate(0).get_displacement();
+    get_iterate(0).set_force(m_work);
   }
 
   void
   advance(const_reference a_time_step)
   {
+    // The history is a circular buffer, so advancing only rotates the index
+    // of the current iterate.  The slot it lands on holds the oldest
+    // iterate, which is overwritten in place with the previous one.
     size_type steps = m_iterates.size();
-    if (steps > 1)
+    if (steps > 0)
     {
-      for (size_type n = steps - 1; n > 0; --n)
+      size_type previous = m_current;
+      m_current = (m_current + steps - 1) % steps;
+      if (m_current != previous)
       {
-        m_iterates[n] = m_iterates[n - 1];
+        m_iterates[m_current] = m_iterates[previous];
       }
-    }
-    if (steps > 0)
-    {
-      m_iterates[0].increment_step();
-      m_iterates[0].set_time_step(a_time_step);
-      m_iterates[0].set_time(m_iterates[0].get_time() + a_time_step);
+      iterate_type& current = m_iterates[m_current];
+      current.increment_step();
+      current.set_time_step(a_time_step);
+      current.set_time(current.get_time() + a_time_step);
     }
   }
 private:
@@ -249,10 +474,273 @@ private:
     // empty
   }
 
-  matrix_type m_mass;
-  matrix_type m_damping;
-  matrix_type m_stiffness;
+  iterate_type&
+  get_iterate(size_type a_step)
+  {
+    return m_iterates[(m_current + a_step) % m_iterates.size()];
+  }
+
+  const iterate_type&
+  get_iterate(size_type a_step) const
+  {
+    return m_iterates[(m_current + a_step) % m_iterates.size()];
+  }
+
+  static
+  bool
+  is_diagonal(const matrix_type& a_matrix)
+  {
+    for (size_type col = 0; col < a_matrix.n_cols; ++col)
+    {
+      for (size_type row = 0; row < a_matrix.n_rows; ++row)
+      {
+        if (row != col && a_matrix(row, col) != value_type(0))
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static
+  bool
+  is_diagonal(const sparse_matrix_type& a_matrix)
+  {
+    typename sparse_matrix_type::const_iterator p;
+    for (p = a_matrix.begin(); p != a_matrix.end(); ++p)
+    {
+      if (p.row() != p.col() && *p != value_type(0))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static
+  vector_type
+  get_diagonal(const matrix_type& a_matrix)
+  {
+    return a_matrix.diag();
+  }
+
+  static
+  vector_type
+  get_diagonal(const sparse_matrix_type& a_matrix)
+  {
+    vector_type diagonal(std::min(a_matrix.n_rows, a_matrix.n_cols));
+    for (size_type n = 0; n < diagonal.n_elem; ++n)
+    {
+      diagonal(n) = a_matrix(n, n);
+    }
+    return diagonal;
+  }
+
+  // The integrators walk the diagonals with raw pointers up to get_size(),
+  // so a matrix or diagonal of any other size is rejected up front.
+
+  void
+  check_size(size_type a_rows, size_type a_cols, const char* a_name) const
+  {
+    if (a_rows != m_size || a_cols != m_size)
+    {
+      boost::format fmt("The %1% matrix must be %2% x %2% but is %3% x %4%");
+      throw std::runtime_error(
+          boost::str(fmt % a_name % m_size % a_rows % a_cols));
+    }
+  }
+
+  template <typename Matrix>
+  void
+  set_matrix(matrix_type& a_dense,
+             sparse_matrix_type& a_sparse,
+             vector_type& a_diagonal,
+             const Matrix& a_value,
+             const char* a_name)
+  {
+    check_size(a_value.n_rows, a_value.n_cols, a_name);
+    if (m_diagonal_storage)
+    {
+      if (!is_diagonal(a_value))
+      {
+        boost::format fmt("The %1% matrix must be diagonal");
+        throw std::runtime_error(boost::str(fmt % a_name));
+      }
+      a_diagonal = get_diagonal(a_value);
+    }
+    else if (m_sparse_storage)
+    {
+      a_sparse = sparse_matrix_type(a_value);
+    }
+    else
+    {
+      a_dense = matrix_type(a_value);
+    }
+    ++m_version;
+  }
+
+  void
+  set_entry(matrix_type& a_dense,
+            sparse_matrix_type& a_sparse,
+            vector_type& a_diagonal,
+            size_type a_row,
+            size_type a_col,
+            const_reference a_value,
+            const char* a_name)
+  {
+    if (a_row >= m_size || a_col >= m_size)
+    {
+      boost::format fmt("The %1% matrix entry (%2%, %3%) is out of range");
+      throw std::runtime_error(boost::str(fmt % a_name % a_row % a_col));
+    }
+    if (m_sparse_storage)
+    {
+      a_sparse(a_row, a_col) = a_value;
+    }
+    else if (!m_diagonal_storage)
+    {
+      a_dense(a_row, a_col) = a_value;
+    }
+    else if (a_row == a_col)
+    {
+      a_diagonal(a_row) = a_value;
+    }
+    else if (a_value != value_type(0))
+    {
+      boost::format fmt("The %1% matrix must be diagonal");
+      throw std::runtime_error(boost::str(fmt % a_name));
+    }
+    ++m_version;
+  }
+
+  void
+  set_diagonal(matrix_type& a_dense,
+               sparse_matrix_type& a_sparse,
+               vector_type& a_diagonal,
+               const vector_type& a_value,
+               const char* a_name)
+  {
+    if (a_value.n_elem != m_size)
+    {
+      boost::format fmt("The %1% diagonal must have %2% entries but has %3%");
+      throw std::runtime_error(
+          boost::str(fmt % a_name % m_size % a_value.n_elem));
+    }
+    if (m_diagonal_storage)
+    {
+      a_diagonal = a_value;
+    }
+    else if (m_sparse_storage)
+    {
+      a_sparse.zeros(a_value.n_elem, a_value.n_elem);
+      for (size_type n = 0; n < a_value.n_elem; ++n)
+      {
+        a_sparse(n, n) = a_value(n);
+      }
+    }
+    else
+    {
+      a_dense = arma::diagmat(a_value);
+    }
+    ++m_version;
+  }
+
+  void
+  detect_diagonal() const
+  {
+    if (m_diagonal_storage || m_detected_version == m_version)
+    {
+      return;
+    }
+    if (m_sparse_storage)
+    {
+      m_diagonal = is_diagonal(m_sparse_mass)
+          && is_diagonal(m_sparse_damping)
+          && is_diagonal(m_sparse_stiffness);
+      if (m_diagonal)
+      {
+        m_mass_diagonal = get_diagonal(m_sparse_mass);
+        m_damping_diagonal = get_diagonal(m_sparse_damping);
+        m_stiffness_diagonal = get_diagonal(m_sparse_stiffness);
+      }
+    }
+    else
+    {
+      m_diagonal = is_diagonal(m_mass)
+          && is_diagonal(m_damping)
+          && is_diagonal(m_stiffness);
+      if (m_diagonal)
+      {
+        m_mass_diagonal = m_mass.diag();
+        m_damping_diagonal = m_damping.diag();
+        m_stiffness_diagonal = m_stiffness.diag();
+      }
+    }
+    m_detected_version = m_version;
+  }
+
+  // The sparse mass matrix is factored once and the factors are reused
+  // until one of the matrices changes.
+
+  void
+  factorize_mass()
+  {
+    if (m_mass_factorization.is_valid() && m_factorized_version == m_version)
+    {
+      return;
+    }
+    m_mass_factorization.compute(m_sparse_mass);
+    m_factorized_version = m_version;
+  }
+
+  void
+  materialize() const
+  {
+    // Dense copies of diagonal and sparse matrices are only built on
+    // request, so that models with many modes never pay for the O(n^2)
+    // storage.
+    if ((!m_diagonal_storage && !m_sparse_storage) ||
+        (m_materialized_version == m_version && m_mass.n_rows == m_size))
+    {
+      return;
+    }
+    if (m_sparse_storage)
+    {
+      m_mass = matrix_type(m_sparse_mass);
+      m_damping = matrix_type(m_sparse_damping);
+      m_stiffness = matrix_type(m_sparse_stiffness);
+    }
+    else
+    {
+      m_mass = arma::diagmat(m_mass_diagonal);
+      m_damping = arma::diagmat(m_damping_diagonal);
+      m_stiffness = arma::diagmat(m_stiffness_diagonal);
+    }
+    m_materialized_version = m_version;
+  }
+
+  size_type m_size;
+  bool m_diagonal_storage;
+  bool m_sparse_storage;
+  mutable matrix_type m_mass;
+  mutable matrix_type m_damping;
+  mutable matrix_type m_stiffness;
+  mutable vector_type m_mass_diagonal;
+  mutable vector_type m_damping_diagonal;
+  mutable vector_type m_stiffness_diagonal;
+  sparse_matrix_type m_sparse_mass;
+  sparse_matrix_type m_sparse_damping;
+  sparse_matrix_type m_sparse_stiffness;
   iterates_type m_iterates;
+  size_type m_current;
+  vector_type m_work;
+  factorization<T> m_mass_factorization;
+  size_type m_version;
+  mutable size_type m_detected_version;
+  mutable size_type m_materialized_version;
+  size_type m_factorized_version;
+  mutable bool m_diagonal;
 }; // eom<T> class
 
 } // yamss namespace
@@ -1,8 +1,10 @@
 #ifndef YAMSS_EVALUATOR_HPP
 #define YAMSS_EVALUATOR_HPP
 
+#include <vector>
 #include <armadillo>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/shared_ptr.hpp>
 #include "yamss/node.hpp"
 
 namespace yamss {
@@ -14,11 +16,126 @@ class evaluator
 public:
   typedef T value_type;
   typedef node<T> node_type;
+  typedef size_t size_type;
   typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef std::vector<node_type> nodes_type;
+  typedef std::vector<size_type> indices_type;
+  typedef boost::shared_ptr<evaluator> pointer;
+
+  evaluator()
+    : m_version(0)
+  {
+    // empty
+  }
+
+  virtual
+  ~evaluator()
+  {
+    // empty
+  }
 
   virtual
   vector_type
   operator()(const value_type& a_time, const node_type& a_node) = 0;
+
+  // The version changes whenever the evaluator is modified, so results
+  // computed at the same time with the same version can be reused.
+
+  size_type
+  get_version() const
+  {
+    return m_version;
+  }
+
+  // Evaluate the load at the nodes a_nodes[a_indices[n]] for n in the range
+  // [a_begin, a_end), storing the result for each n in column n of a_forces.
+  // Derived classes may override this to evaluate the whole range at once.
+
+  virtual
+  void
+  evaluate(const value_type& a_time,
+           const nodes_type& a_nodes,
+           const indices_type& a_indices,
+           size_type a_begin,
+           size_type a_end,
+           matrix_type& a_forces)
+  {
+    for (size_type n = a_begin; n < a_end; ++n)
+    {
+      a_forces.col(n) = operator()(a_time, a_nodes[a_indices[n]]);
+    }
+  }
+
+  // Loads that do not depend on time only need to be evaluated again when
+  // their version changes.
+
+  virtual
+  bool
+  is_time_dependent() const
+  {
+    return true;
+  }
+
+  // A separable load has the form h(t) g(x), where the scale h depends only
+  // on time and the shape g only on position.  The structure evaluates the
+  // shape once, and then only the scale at each time step.  Loads that do
+  // not depend on time are separable with a scale of one.
+
+  virtual
+  bool
+  is_separable() const
+  {
+    return false;
+  }
+
+  virtual
+  value_type
+  get_scale(const value_type& a_time)
+  {
+    return value_type(1);
+  }
+
+  virtual
+  void
+  evaluate_shape(const nodes_type& a_nodes,
+                 const indices_type& a_indices,
+                 size_type a_begin,
+                 size_type a_end,
+                 matrix_type& a_forces)
+  {
+    evaluate(value_type(0), a_nodes, a_indices, a_begin, a_end, a_forces);
+  }
+
+  // The load calls this whenever the node indices it passes to evaluate()
+  // change, even if their number does not.  Evaluators that keep data per
+  // node drop it here.
+
+  virtual
+  void
+  invalidate_nodes()
+  {
+    // empty
+  }
+
+  // Return an independent copy for use on another thread.  An empty pointer
+  // means that operator() does not modify the evaluator, so one instance can
+  // be shared by every thread.
+
+  virtual
+  pointer
+  clone() const
+  {
+    return pointer();
+  }
+protected:
+  void
+  touch()
+  {
+    ++m_version;
+  }
+private:
+  size_type m_version;
 }; // evaluator<T> class
 
 } // evaluator namespace
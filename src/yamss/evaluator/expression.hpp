@@ -0,0 +1,410 @@
+#ifndef YAMSS_EVALUATOR_EXPRESSION_HPP
+#define YAMSS_EVALUATOR_EXPRESSION_HPP
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <armadillo>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include "yamss/complex.hpp"
+#include "yamss/evaluator/evaluator.hpp"
+#include "yamss/evaluator/lua.hpp"
+#include "yamss/evaluator/program.hpp"
+
+namespace yamss {
+namespace evaluator {
+
+// The expression evaluator accepts the same parameters as the Lua evaluator.
+// Expressions that stay within the arithmetic subset understood by program
+// are compiled and evaluated natively, a block of nodes at a time.  If any
+// expression falls outside that subset, all of them are handed to a Lua
+// evaluator instead.
+
+template <typename T = double>
+class expression : public evaluator<T>
+{
+public:
+  typedef T value_type;
+  typedef node<T> node_type;
+  typedef size_t size_type;
+  typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef typename evaluator<T>::nodes_type nodes_type;
+  typedef typename evaluator<T>::indices_type indices_type;
+  typedef typename evaluator<T>::pointer pointer;
+
+  expression()
+    : m_programs(6)
+    , m_expressions(6)
+    , m_separable(false)
+  {
+    // empty
+  }
+
+  expression(const boost::property_tree::ptree& a_tree)
+    : m_programs(6)
+    , m_expressions(6)
+    , m_separable(false)
+  {
+    static const char* const keys[6] = {
+      "expressions.x", "expressions.y", "expressions.z",
+      "expressions.p", "expressions.q", "expressions.r"
+    };
+
+    boost::optional<std::string> eq;
+    for (int dof = 0; dof < 6; ++dof)
+    {
+      if ((eq = a_tree.get_optional<std::string>(keys[dof])))
+      {
+        set_expression(dof, *eq);
+      }
+    }
+    if (a_tree.get_child_optional("separable"))
+    {
+      set_separable(true);
+      if ((eq = a_tree.get_optional<std::string>("separable.time")))
+      {
+        set_scale_expression(*eq);
+      }
+    }
+  }
+
+  virtual
+  ~expression()
+  {
+    // empty
+  }
+
+  void
+  clear_expression(int a_dof)
+  {
+    m_programs[a_dof].clear();
+    m_expressions[a_dof].clear();
+    update_fallback();
+  }
+
+  void
+  set_expression(int a_dof, const std::string& a_expression)
+  {
+    m_expressions[a_dof] = a_expression;
+    if (!m_programs[a_dof].compile(a_expression))
+    {
+      m_programs[a_dof].clear();
+    }
+    update_fallback();
+  }
+
+  void
+  set_separable(bool a_separable)
+  {
+    m_separable = a_separable;
+    update_fallback();
+  }
+
+  void
+  set_scale_expression(const std::string& a_expression)
+  {
+    m_scale_expression = a_expression;
+    if (!m_scale.compile(a_expression))
+    {
+      m_scale.clear();
+    }
+    update_fallback();
+  }
+
+  void
+  clear_scale_expression()
+  {
+    m_scale.clear();
+    m_scale_expression.clear();
+    update_fallback();
+  }
+
+  bool
+  is_compiled() const
+  {
+    return !m_fallback;
+  }
+
+  // Besides loads declared separable, a compiled load whose expressions do
+  // not refer to t is recognized as time-invariant.
+
+  virtual
+  bool
+  is_separable() const
+  {
+    if (m_separable || m_fallback)
+    {
+      return m_separable;
+    }
+    for (int dof = 0; dof < 6; ++dof)
+    {
+      if (m_programs[dof].depends_on(program::T))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  virtual
+  value_type
+  get_scale(const value_type& a_time)
+  {
+    if (m_fallback)
+    {
+      return m_fallback->get_scale(a_time);
+    }
+    if (!m_separable || m_scale.empty())
+    {
+      return value_type(1);
+    }
+    double variables[program::NUMBER_OF_VARIABLES] = {0.0};
+    variables[program::T] = ::yamss::real(a_time);
+    const double* pointers[program::NUMBER_OF_VARIABLES];
+    for (size_type v = 0; v < program::NUMBER_OF_VARIABLES; ++v)
+    {
+      pointers[v] = variables + v;
+    }
+    double scale;
+    m_scale.run(pointers, 1, &scale);
+    return scale;
+  }
+
+  virtual
+  vector_type
+  operator()(const value_type& a_time, const node_type& a_node)
+  {
+    if (m_fallback)
+    {
+      return m_fallback->operator()(a_time, a_node);
+    }
+
+    double variables[program::NUMBER_OF_VARIABLES];
+    variables[program::T] = ::yamss::real(a_time);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      variables[program::X + dof] = ::yamss::real(a_node.get_position(dof));
+    }
+    return get_scale(a_time) * apply(variables);
+  }
+
+  vector_type
+  operator()(const vector_type& a_position)
+  {
+    if (m_fallback)
+    {
+      return m_fallback->operator()(a_position);
+    }
+
+    double variables[program::NUMBER_OF_VARIABLES] = {0.0};
+    const size_type n_dofs = std::min<size_type>(a_position.size(), 6);
+    for (size_type dof = 0; dof < n_dofs; ++dof)
+    {
+      variables[program::X + dof] = ::yamss::real(a_position(dof));
+    }
+    return apply(variables);
+  }
+
+  virtual
+  void
+  evaluate(const value_type& a_time,
+           const nodes_type& a_nodes,
+           const indices_type& a_indices,
+           size_type a_begin,
+           size_type a_end,
+           matrix_type& a_forces)
+  {
+    if (m_fallback)
+    {
+      m_fallback->evaluate(a_time, a_nodes, a_indices, a_begin, a_end,
+                           a_forces);
+      return;
+    }
+    evaluate_block(a_time, a_nodes, a_indices, a_begin, a_end, a_forces);
+    if (m_separable && !m_scale.empty() && a_begin < a_end)
+    {
+      a_forces.cols(a_begin, a_end - 1) *= get_scale(a_time);
+    }
+  }
+
+  virtual
+  void
+  evaluate_shape(const nodes_type& a_nodes,
+                 const indices_type& a_indices,
+                 size_type a_begin,
+                 size_type a_end,
+                 matrix_type& a_forces)
+  {
+    if (m_fallback)
+    {
+      m_fallback->evaluate_shape(a_nodes, a_indices, a_begin, a_end,
+                                 a_forces);
+      return;
+    }
+    evaluate_block(value_type(0), a_nodes, a_indices, a_begin, a_end,
+                   a_forces);
+  }
+
+  virtual
+  void
+  invalidate_nodes()
+  {
+    if (m_fallback)
+    {
+      m_fallback->invalidate_nodes();
+    }
+  }
+
+  // Compiled programs are never modified by evaluation, so a compiled
+  // expression can be shared between threads.  Only the Lua fallback needs
+  // a copy of its own.
+
+  virtual
+  pointer
+  clone() const
+  {
+    if (!m_fallback)
+    {
+      return pointer();
+    }
+    boost::shared_ptr<expression> other = boost::make_shared<expression>();
+    for (int dof = 0; dof < 6; ++dof)
+    {
+      if (!m_expressions[dof].empty())
+      {
+        other->set_expression(dof, m_expressions[dof]);
+      }
+    }
+    other->set_separable(m_separable);
+    if (!m_scale_expression.empty())
+    {
+      other->set_scale_expression(m_scale_expression);
+    }
+    return other;
+  }
+protected:
+  void
+  evaluate_block(const value_type& a_time,
+                 const nodes_type& a_nodes,
+                 const indices_type& a_indices,
+                 size_type a_begin,
+                 size_type a_end,
+                 matrix_type& a_forces) const
+  {
+    const size_type block = program::max_block_size;
+    double values[program::NUMBER_OF_VARIABLES][program::max_block_size];
+    double result[program::max_block_size];
+    const double* variables[program::NUMBER_OF_VARIABLES];
+    for (size_type v = 0; v < program::NUMBER_OF_VARIABLES; ++v)
+    {
+      variables[v] = values[v];
+    }
+    std::fill(values[program::T], values[program::T] + block,
+              ::yamss::real(a_time));
+
+    for (size_type first = a_begin; first < a_end; first += block)
+    {
+      const size_type size = std::min(block, a_end - first);
+      for (size_type i = 0; i < size; ++i)
+      {
+        const node_type& node_ = a_nodes[a_indices[first + i]];
+        for (size_type dof = 0; dof < 6; ++dof)
+        {
+          values[program::X + dof][i] = ::yamss::real(node_.get_position(dof));
+        }
+      }
+      for (size_type dof = 0; dof < 6; ++dof)
+      {
+        if (m_programs[dof].empty())
+        {
+          for (size_type i = 0; i < size; ++i)
+          {
+            a_forces(dof, first + i) = value_type(0);
+          }
+        }
+        else
+        {
+          m_programs[dof].run(variables, size, result);
+          for (size_type i = 0; i < size; ++i)
+          {
+            a_forces(dof, first + i) = result[i];
+          }
+        }
+      }
+    }
+  }
+
+  vector_type
+  apply(const double a_variables[program::NUMBER_OF_VARIABLES]) const
+  {
+    const double* variables[program::NUMBER_OF_VARIABLES];
+    for (size_type v = 0; v < program::NUMBER_OF_VARIABLES; ++v)
+    {
+      variables[v] = a_variables + v;
+    }
+
+    vector_type vec(6);
+    vec.zeros();
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      if (!m_programs[dof].empty())
+      {
+        double result;
+        m_programs[dof].run(variables, 1, &result);
+        vec(dof) = result;
+      }
+    }
+    return vec;
+  }
+
+  void
+  update_fallback()
+  {
+    this->touch();
+    m_fallback.reset();
+    for (int dof = 0; dof < 6; ++dof)
+    {
+      if (!m_expressions[dof].empty() && m_programs[dof].empty())
+      {
+        m_fallback = boost::make_shared<lua<T> >();
+        break;
+      }
+    }
+    if (!m_scale_expression.empty() && m_scale.empty())
+    {
+      m_fallback = boost::make_shared<lua<T> >();
+    }
+    if (m_fallback)
+    {
+      for (int dof = 0; dof < 6; ++dof)
+      {
+        if (!m_expressions[dof].empty())
+        {
+          m_fallback->set_expression(dof, m_expressions[dof]);
+        }
+      }
+      m_fallback->set_separable(m_separable);
+      if (!m_scale_expression.empty())
+      {
+        m_fallback->set_scale_expression(m_scale_expression);
+      }
+    }
+  }
+private:
+  typedef std::vector<program> programs_type;
+  typedef std::vector<std::string> expressions_type;
+
+  programs_type m_programs;
+  expressions_type m_expressions;
+  bool m_separable;
+  program m_scale;
+  std::string m_scale_expression;
+  boost::shared_ptr<lua<T> > m_fallback;
+}; // expression<T> class
+
+} // evaluator namespace
+} // yamss namespace
+
+#endif // YAMSS_EVALUATOR_EXPRESSION_HPP
@@ -1,6 +1,7 @@
 #ifndef YAMSS_EVALUATOR_INTERFACE_HPP
 #define YAMSS_EVALUATOR_INTERFACE_HPP
 
+#include <utility>
 #include <boost/unordered_map.hpp>
 #include "yamss/evaluator/evaluator.hpp"
 
@@ -42,10 +43,34 @@ public:
     }
   }
 
+  virtual
+  bool
+  is_time_dependent() const
+  {
+    return false;
+  }
+
+  // Inserting the load that a node already carries leaves the version
+  // unchanged, so resending unchanged loads costs nothing downstream.
+
   void
   insert(const key_type& a_key, const vector_type& a_load)
   {
-    m_loads[a_key] = a_load;
+    typename map_type::iterator p = m_loads.find(a_key);
+    if (p == m_loads.end())
+    {
+      m_loads.insert(std::make_pair(a_key, a_load));
+    }
+    else if (p->second.n_elem != a_load.n_elem
+             || arma::any(p->second != a_load))
+    {
+      p->second = a_load;
+    }
+    else
+    {
+      return;
+    }
+    this->touch();
   }
 private:
   typedef boost::unordered_map<key_type, vector_type> map_type;
@@ -1,6 +1,7 @@
 #ifndef YAMSS_EVALUATOR_LUA_HPP
 #define YAMSS_EVALUATOR_LUA_HPP
 
+#include <algorithm>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -24,11 +25,25 @@ class lua : public evaluator<T>
 public:
   typedef T value_type;
   typedef node<T> node_type;
+  typedef size_t size_type;
   typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef typename evaluator<T>::nodes_type nodes_type;
+  typedef typename evaluator<T>::indices_type indices_type;
+  typedef typename evaluator<T>::pointer pointer;
 
   lua()
     : m_state(0)
     , m_references(6, LUA_NOREF)
+    , m_expressions(6)
+    , m_separable(false)
+    , m_scale(LUA_NOREF)
+    , m_batch(LUA_NOREF)
+    , m_arrays(7, LUA_NOREF)
+    , m_coordinates_valid(false)
+    , m_coordinates_begin(0)
+    , m_coordinates_end(0)
+    , m_coordinates_version(0)
     , m_expression_formatter("return %1%")
   {
     // empty
@@ -37,6 +52,15 @@ public:
   lua(const boost::property_tree::ptree& a_tree)
     : m_state(0)
     , m_references(6, LUA_NOREF)
+    , m_expressions(6)
+    , m_separable(false)
+    , m_scale(LUA_NOREF)
+    , m_batch(LUA_NOREF)
+    , m_arrays(7, LUA_NOREF)
+    , m_coordinates_valid(false)
+    , m_coordinates_begin(0)
+    , m_coordinates_end(0)
+    , m_coordinates_version(0)
     , m_expression_formatter("return %1%")
   {
     boost::optional<std::string> eq;
@@ -64,6 +88,14 @@ public:
     {
       set_expression(5, *eq);
     }
+    if (a_tree.get_child_optional("separable"))
+    {
+      set_separable(true);
+      if ((eq = a_tree.get_optional<std::string>("separable.time")))
+      {
+        set_scale_expression(*eq);
+      }
+    }
   }
 
   virtual
@@ -77,6 +109,9 @@ public:
   {
     luaL_unref(m_state, LUA_REGISTRYINDEX, m_references[a_dof]);
     m_references[a_dof] = LUA_NOREF;
+    m_expressions[a_dof].clear();
+    clear_batch();
+    this->touch();
   }
 
   void
@@ -84,15 +119,72 @@ public:
   {
     bootstrap();
     clear_expression(a_dof);
-    std::string expression = boost::str(m_expression_formatter % a_expression);
-    int code = luaL_loadstring(m_state, expression.c_str());
+    m_references[a_dof] = load_expression(a_expression);
+    m_expressions[a_dof] = a_expression;
+    this->touch();
+  }
+
+  // When the load is declared separable, the expressions above give its
+  // shape and the scale expression, a function of t alone, multiplies them.
+  // Without a scale expression the load is taken not to depend on time.
+
+  void
+  set_separable(bool a_separable)
+  {
+    m_separable = a_separable;
+    this->touch();
+  }
+
+  void
+  set_scale_expression(const std::string& a_expression)
+  {
+    bootstrap();
+    clear_scale_expression();
+    m_scale = load_expression(a_expression);
+    m_scale_expression = a_expression;
+    this->touch();
+  }
+
+  void
+  clear_scale_expression()
+  {
+    if (m_state)
+    {
+      luaL_unref(m_state, LUA_REGISTRYINDEX, m_scale);
+    }
+    m_scale = LUA_NOREF;
+    m_scale_expression.clear();
+    this->touch();
+  }
+
+  virtual
+  bool
+  is_separable() const
+  {
+    return m_separable;
+  }
+
+  virtual
+  value_type
+  get_scale(const value_type& a_time)
+  {
+    if (!m_separable || m_scale_expression.empty())
+    {
+      return value_type(1);
+    }
+    bootstrap();
+    lua_pushnumber(m_state, ::yamss::real(a_time));
+    lua_setglobal(m_state, "t");
+    lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_scale);
+    int code = lua_pcall(m_state, 0, 1, 0);
     if (code != LUA_OK)
     {
       close();
-      boost::format fmt("Could not save the expression [%1%]");
-      throw std::runtime_error(boost::str(fmt % a_expression));
+      throw std::runtime_error("Could not evaluate an expression");
     }
-    m_references[a_dof] = luaL_ref(m_state, LUA_REGISTRYINDEX);
+    value_type scale = lua_tonumber(m_state, -1);
+    lua_pop(m_state, 1);
+    return scale;
   }
 
   virtual
@@ -101,7 +193,12 @@ public:
   {
     bootstrap();
     set_globals(a_time, a_node);
-    return apply();
+    vector_type vec = apply();
+    if (m_separable && !m_scale_expression.empty())
+    {
+      vec *= get_scale(a_time);
+    }
+    return vec;
   }
 
   vector_type
@@ -111,6 +208,69 @@ public:
     set_globals(a_position);
     return apply();
   }
+
+  // All of the expressions are compiled into a single Lua function that
+  // loops over arrays of nodal coordinates, so a whole range of nodes costs
+  // one call into Lua rather than several per node.  If the expressions
+  // cannot be compiled that way, the nodes are evaluated one at a time.
+
+  virtual
+  void
+  evaluate(const value_type& a_time,
+           const nodes_type& a_nodes,
+           const indices_type& a_indices,
+           size_type a_begin,
+           size_type a_end,
+           matrix_type& a_forces)
+  {
+    evaluate_batch(a_time, a_nodes, a_indices, a_begin, a_end, a_forces);
+    if (m_separable && !m_scale_expression.empty() && a_begin < a_end)
+    {
+      a_forces.cols(a_begin, a_end - 1) *= get_scale(a_time);
+    }
+  }
+
+  virtual
+  void
+  evaluate_shape(const nodes_type& a_nodes,
+                 const indices_type& a_indices,
+                 size_type a_begin,
+                 size_type a_end,
+                 matrix_type& a_forces)
+  {
+    evaluate_batch(value_type(0), a_nodes, a_indices, a_begin, a_end,
+                   a_forces);
+  }
+
+  virtual
+  void
+  invalidate_nodes()
+  {
+    m_coordinates_valid = false;
+  }
+
+  // A Lua state cannot be used by two threads at once, so each copy compiles
+  // the expressions into a state of its own.
+
+  virtual
+  pointer
+  clone() const
+  {
+    boost::shared_ptr<lua> other(new lua());
+    for (size_t n = 0; n < m_expressions.size(); ++n)
+    {
+      if (!m_expressions[n].empty())
+      {
+        other->set_expression(n, m_expressions[n]);
+      }
+    }
+    other->set_separable(m_separable);
+    if (!m_scale_expression.empty())
+    {
+      other->set_scale_expression(m_scale_expression);
+    }
+    return other;
+  }
 protected:
   void
   open()
@@ -131,15 +291,49 @@ protected:
       lua_close(m_state);
       m_state = 0;
     }
+    std::fill(m_references.begin(), m_references.end(), LUA_NOREF);
+    m_scale = LUA_NOREF;
+    m_batch = LUA_NOREF;
+    std::fill(m_arrays.begin(), m_arrays.end(), LUA_NOREF);
+    m_coordinates_valid = false;
   }
 
+  // The state is closed whenever an expression fails, which drops every
+  // function compiled into its registry, so a new state compiles the saved
+  // expressions again before anything is evaluated.
+
   void
   bootstrap()
   {
     if (!m_state)
     {
       open();
+      for (size_type n = 0; n < m_expressions.size(); ++n)
+      {
+        if (!m_expressions[n].empty())
+        {
+          m_references[n] = load_expression(m_expressions[n]);
+        }
+      }
+      if (!m_scale_expression.empty())
+      {
+        m_scale = load_expression(m_scale_expression);
+      }
+    }
+  }
+
+  int
+  load_expression(const std::string& a_expression)
+  {
+    std::string expression = boost::str(m_expression_formatter % a_expression);
+    int code = luaL_loadstring(m_state, expression.c_str());
+    if (code != LUA_OK)
+    {
+      close();
+      boost::format fmt("Could not save the expression [%1%]");
+      throw std::runtime_error(boost::str(fmt % a_expression));
     }
+    return luaL_ref(m_state, LUA_REGISTRYINDEX);
   }
 
   void
@@ -184,6 +378,158 @@ protected:
     }
   }
 
+  void
+  evaluate_batch(const value_type& a_time,
+                 const nodes_type& a_nodes,
+                 const indices_type& a_indices,
+                 size_type a_begin,
+                 size_type a_end,
+                 matrix_type& a_forces)
+  {
+    bootstrap();
+    if (m_batch == LUA_NOREF)
+    {
+      compile_batch();
+    }
+    if (m_batch == LUA_REFNIL)
+    {
+      for (size_type n = a_begin; n < a_end; ++n)
+      {
+        set_globals(a_time, a_nodes[a_indices[n]]);
+        a_forces.col(n) = apply();
+      }
+      return;
+    }
+
+    if (a_begin >= a_end)
+    {
+      return;
+    }
+    const int size = static_cast<int>(a_end - a_begin);
+    fill_coordinates(a_nodes, a_indices, a_begin, a_end);
+
+    lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_batch);
+    lua_pushnumber(m_state, ::yamss::real(a_time));
+    lua_pushinteger(m_state, size);
+    for (size_type n = 0; n < m_arrays.size(); ++n)
+    {
+      lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_arrays[n]);
+    }
+    int code = lua_pcall(m_state, 9, 0, 0);
+    if (code != LUA_OK)
+    {
+      close();
+      throw std::runtime_error("Could not evaluate an expression");
+    }
+
+    lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_arrays[6]);
+    for (int i = 0; i < size; ++i)
+    {
+      for (int dof = 0; dof < 6; ++dof)
+      {
+        lua_rawgeti(m_state, -1, 6 * i + dof + 1);
+        a_forces(dof, a_begin + i) = lua_tonumber(m_state, -1);
+        lua_pop(m_state, 1);
+      }
+    }
+    lua_pop(m_state, 1);
+  }
+
+  // The coordinate arrays stay in the Lua state from one step to the next.
+  // They are only filled again when the range of nodes changes, when the
+  // version of the node positions does, which also covers nodes being added
+  // or renumbered, or when the load resolves its node indices again; see
+  // invalidate_nodes().
+
+  void
+  fill_coordinates(const nodes_type& a_nodes,
+                   const indices_type& a_indices,
+                   size_type a_begin,
+                   size_type a_end)
+  {
+    const size_type version = a_nodes[a_indices[a_begin]]
+                                  .get_positions_version();
+    if (m_coordinates_valid
+        && m_coordinates_begin == a_begin
+        && m_coordinates_end == a_end
+        && m_coordinates_version == version)
+    {
+      return;
+    }
+
+    const int size = static_cast<int>(a_end - a_begin);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_arrays[dof]);
+      for (int i = 0; i < size; ++i)
+      {
+        const node_type& node_ = a_nodes[a_indices[a_begin + i]];
+        lua_pushnumber(m_state, ::yamss::real(node_.get_position(dof)));
+        lua_rawseti(m_state, -2, i + 1);
+      }
+      lua_pop(m_state, 1);
+    }
+    m_coordinates_valid = true;
+    m_coordinates_begin = a_begin;
+    m_coordinates_end = a_end;
+    m_coordinates_version = version;
+  }
+
+  // The batch function takes the time, the number of nodes, six arrays of
+  // coordinates, and an output array that receives six components per node.
+  // The coordinates are bound to locals named as in the per-node globals, so
+  // the expressions read the same in both forms.
+
+  void
+  compile_batch()
+  {
+    std::string source =
+        "local t, __n, __x, __y, __z, __p, __q, __r, __f = ...\n"
+        "for __i = 1, __n do\n"
+        "  local x, y, z = __x[__i], __y[__i], __z[__i]\n"
+        "  local p, q, r = __p[__i], __q[__i], __r[__i]\n"
+        "  local __k = 6 * (__i - 1)\n";
+    for (size_type n = 0; n < 6; ++n)
+    {
+      boost::format fmt("  __f[__k + %1%] = %2%\n");
+      if (m_references[n] == LUA_NOREF)
+      {
+        source += boost::str(fmt % (n + 1) % "0");
+      }
+      else
+      {
+        source += boost::str(fmt % (n + 1) % ("(" + m_expressions[n] + ")"));
+      }
+    }
+    source += "end\n";
+
+    if (luaL_loadstring(m_state, source.c_str()) != LUA_OK)
+    {
+      lua_pop(m_state, 1);
+      m_batch = LUA_REFNIL;
+      return;
+    }
+    m_batch = luaL_ref(m_state, LUA_REGISTRYINDEX);
+    for (size_type n = 0; n < m_arrays.size(); ++n)
+    {
+      if (m_arrays[n] == LUA_NOREF)
+      {
+        lua_newtable(m_state);
+        m_arrays[n] = luaL_ref(m_state, LUA_REGISTRYINDEX);
+      }
+    }
+  }
+
+  void
+  clear_batch()
+  {
+    if (m_state)
+    {
+      luaL_unref(m_state, LUA_REGISTRYINDEX, m_batch);
+    }
+    m_batch = LUA_NOREF;
+  }
+
   vector_type
   apply()
   {
@@ -208,9 +554,20 @@ protected:
   }
 private:
   typedef std::vector<int> references_type;
+  typedef std::vector<std::string> expressions_type;
 
   lua_State* m_state;
   references_type m_references;
+  expressions_type m_expressions;
+  bool m_separable;
+  int m_scale;
+  std::string m_scale_expression;
+  int m_batch;
+  references_type m_arrays;
+  bool m_coordinates_valid;
+  size_type m_coordinates_begin;
+  size_type m_coordinates_end;
+  size_type m_coordinates_version;
   boost::format m_expression_formatter;
 }; // lua<T> class
 
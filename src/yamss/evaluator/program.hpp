@@ -0,0 +1,135 @@
+#ifndef YAMSS_EVALUATOR_PROGRAM_HPP
+#define YAMSS_EVALUATOR_PROGRAM_HPP
+
+#include <string>
+#include <vector>
+
+namespace yamss {
+namespace evaluator {
+
+// A program is an arithmetic expression, written in a subset of the Lua
+// expression syntax, compiled into postfix instructions.  Each instruction
+// is applied to a whole block of points at once, so the inner loops are
+// short and branch-free.  Programs are immutable once compiled and can be
+// run by several threads at the same time.
+
+class program
+{
+public:
+  typedef size_t size_type;
+
+  enum variable_type
+  {
+    T,
+    X,
+    Y,
+    Z,
+    P,
+    Q,
+    R,
+    NUMBER_OF_VARIABLES
+  };
+
+  static const size_type max_block_size = 64;
+  static const size_type max_depth = 32;
+
+  program();
+
+  program(const program& a_other);
+
+  ~program();
+
+  program&
+  operator=(const program& a_other);
+
+  bool
+  compile(const std::string& a_expression);
+
+  void
+  clear();
+
+  bool
+  empty() const;
+
+  size_type
+  get_depth() const;
+
+  bool
+  depends_on(variable_type a_variable) const;
+
+  // Evaluate the program at a_size points, where a_size is at most
+  // max_block_size.  a_variables[v] points to the a_size values of variable
+  // v, and the a_size results are written to a_result.
+
+  void
+  run(const double* const a_variables[NUMBER_OF_VARIABLES],
+      size_type a_size,
+      double* a_result) const;
+protected:
+  enum opcode_type
+  {
+    CONSTANT,
+    VARIABLE,
+    NEGATE,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    MODULO,
+    POWER,
+    MINIMUM,
+    MAXIMUM,
+    ATAN2,
+    FMOD,
+    LOGARITHM,
+    SIN,
+    COS,
+    TAN,
+    ASIN,
+    ACOS,
+    ATAN,
+    EXP,
+    LOG,
+    SQRT,
+    ABS,
+    FLOOR,
+    CEIL
+  };
+
+  struct instruction
+  {
+    opcode_type opcode;
+    size_type variable;
+    double value;
+  };
+
+  typedef std::vector<instruction> instructions_type;
+
+  class parser;
+
+  void
+  emit(opcode_type a_opcode);
+
+  void
+  emit_constant(double a_value);
+
+  void
+  emit_variable(size_type a_variable);
+
+  static
+  int
+  get_arity(opcode_type a_opcode);
+
+  static
+  double
+  apply(opcode_type a_opcode, double a_x, double a_y);
+private:
+  instructions_type m_instructions;
+  size_type m_size;
+  size_type m_depth;
+}; // program class
+
+} // evaluator namespace
+} // yamss namespace
+
+#endif // YAMSS_EVALUATOR_PROGRAM_HPP
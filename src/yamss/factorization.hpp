@@ -0,0 +1,460 @@
+#ifndef YAMSS_FACTORIZATION_HPP
+#define YAMSS_FACTORIZATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include <armadillo>
+#include "yamss/ordering.hpp"
+
+namespace yamss {
+
+template <typename T = double>
+class factorization
+{
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+  typedef arma::Col<arma::uword> index_type;
+
+  factorization()
+    : m_valid(false)
+    , m_cholesky(false)
+    , m_diagonal(false)
+    , m_sparse(false)
+  {
+    // empty
+  }
+
+  factorization(const matrix_type& a_matrix)
+    : m_valid(false)
+    , m_cholesky(false)
+    , m_diagonal(false)
+    , m_sparse(false)
+  {
+    compute(a_matrix);
+  }
+
+  factorization(const sparse_matrix_type& a_matrix)
+    : m_valid(false)
+    , m_cholesky(false)
+    , m_diagonal(false)
+    , m_sparse(false)
+  {
+    compute(a_matrix);
+  }
+
+  ~factorization()
+  {
+    // empty
+  }
+
+  bool
+  is_valid() const
+  {
+    return m_valid;
+  }
+
+  bool
+  is_cholesky() const
+  {
+    return m_cholesky;
+  }
+
+  bool
+  is_diagonal() const
+  {
+    return m_diagonal;
+  }
+
+  bool
+  is_sparse() const
+  {
+    return m_sparse;
+  }
+
+  size_type
+  get_size() const
+  {
+    if (m_sparse)
+    {
+      return m_order.size();
+    }
+    return m_diagonal ? m_reciprocals.n_elem : m_upper.n_rows;
+  }
+
+  const vector_type&
+  get_reciprocals() const
+  {
+    return m_reciprocals;
+  }
+
+  void
+  reset()
+  {
+    m_valid = false;
+    m_cholesky = false;
+    m_diagonal = false;
+    m_sparse = false;
+  }
+
+  void
+  compute(const matrix_type& a_matrix)
+  {
+    reset();
+    if (is_hermitian(a_matrix) && arma::chol(m_upper, a_matrix))
+    {
+      m_lower = m_upper.t();
+      m_pivots.reset();
+      m_cholesky = true;
+    }
+    else
+    {
+      // The factorization succeeds on a singular matrix too, leaving a zero
+      // on the diagonal of the upper factor, which the solve would divide by.
+      matrix_type permutation;
+      if (!arma::lu(m_lower, m_upper, permutation, a_matrix)
+          || m_upper.n_rows != m_upper.n_cols)
+      {
+        throw std::runtime_error("Could not factorize the matrix");
+      }
+      for (size_type n = 0; n < m_upper.n_rows; ++n)
+      {
+        if (m_upper(n, n) == value_type(0))
+        {
+          throw std::runtime_error("Could not factorize the matrix");
+        }
+      }
+      set_pivots(permutation);
+    }
+    m_valid = true;
+  }
+
+  // Sparse matrices are reordered by reverse Cuthill-McKee and factored in
+  // envelope (skyline) form, so fill-in is confined to the profile of the
+  // reordered matrix.  Pivoting would break the profile, so there is none;
+  // if a pivot is small relative to its row and column, or the factors grow
+  // large, the matrix is factored as a dense one, with partial pivoting.
+
+  void
+  compute(const sparse_matrix_type& a_matrix)
+  {
+    reset();
+    if (a_matrix.n_rows != a_matrix.n_cols)
+    {
+      throw std::runtime_error("Could not factorize the matrix");
+    }
+    if (!compute_envelope(a_matrix))
+    {
+      compute(matrix_type(a_matrix));
+      return;
+    }
+    m_sparse = true;
+    m_valid = true;
+  }
+
+  void
+  compute_diagonal(const vector_type& a_diagonal)
+  {
+    reset();
+    for (size_type n = 0; n < a_diagonal.n_elem; ++n)
+    {
+      if (a_diagonal(n) == value_type(0))
+      {
+        throw std::runtime_error("Could not factorize the matrix");
+      }
+    }
+    m_reciprocals = 1.0 / a_diagonal;
+    m_diagonal = true;
+    m_valid = true;
+  }
+
+  void
+  solve(vector_type& a_x, const vector_type& a_b) const
+  {
+    if (m_diagonal)
+    {
+      a_x = a_b % m_reciprocals;
+      return;
+    }
+    if (m_sparse)
+    {
+      solve_envelope(a_x, a_b);
+      return;
+    }
+    solve_dense(a_x, a_b);
+  }
+protected:
+  static
+  bool
+  is_hermitian(const matrix_type& a_matrix)
+  {
+    // The test is exact on purpose.  A tolerance would let complex-step
+    // perturbations through to the Cholesky path, which is not analytic.
+    if (a_matrix.n_rows != a_matrix.n_cols)
+    {
+      return false;
+    }
+    matrix_type adjoint = a_matrix.t();
+    for (size_type col = 0; col < a_matrix.n_cols; ++col)
+    {
+      for (size_type row = col; row < a_matrix.n_rows; ++row)
+      {
+        if (a_matrix(row, col) != adjoint(row, col))
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void
+  set_pivots(const matrix_type& a_permutation)
+  {
+    // Armadillo factors A as P' L U, so row n of P picks the entry of the
+    // right-hand side that belongs in row n of the triangular solve.
+    size_type size = a_permutation.n_rows;
+    m_pivots.set_size(size);
+    for (size_type row = 0; row < size; ++row)
+    {
+      for (size_type col = 0; col < size; ++col)
+      {
+        if (a_permutation(row, col) != value_type(0))
+        {
+          m_pivots(row) = col;
+          break;
+        }
+      }
+    }
+  }
+
+  // The triangular solves run column by column into the workspace and a_x,
+  // both of which keep their storage from one call to the next, so a solve
+  // allocates nothing once the sizes are settled.  The lower factor has a
+  // unit diagonal after an LU factorization; dividing by it is harmless.
+
+  void
+  solve_dense(vector_type& a_x, const vector_type& a_b) const
+  {
+    const size_type size = m_upper.n_rows;
+    m_work.set_size(size);
+    for (size_type i = 0; i < size; ++i)
+    {
+      m_work(i) = m_cholesky ? a_b(i) : a_b(m_pivots(i));
+    }
+    for (size_type j = 0; j < size; ++j)
+    {
+      const value_type* lower_j = m_lower.colptr(j);
+      const value_type w = m_work(j) / lower_j[j];
+      m_work(j) = w;
+      for (size_type i = j + 1; i < size; ++i)
+      {
+        m_work(i) -= lower_j[i] * w;
+      }
+    }
+    a_x.set_size(size);
+    for (size_type j = size; j-- > 0; )
+    {
+      const value_type* upper_j = m_upper.colptr(j);
+      const value_type x = m_work(j) / upper_j[j];
+      a_x(j) = x;
+      for (size_type i = 0; i < j; ++i)
+      {
+        m_work(i) -= upper_j[i] * x;
+      }
+    }
+  }
+
+  // A pivot is accepted if it is at least get_pivot_threshold() times the
+  // largest entry of its row and column in the original matrix.  The entries
+  // of the upper factor may be at most get_growth_limit() times the largest
+  // entry of the matrix, and the multipliers of the lower factor at most
+  // get_growth_limit() itself.
+
+  static
+  double
+  get_pivot_threshold()
+  {
+    return std::sqrt(std::numeric_limits<double>::epsilon());
+  }
+
+  static
+  double
+  get_growth_limit()
+  {
+    return 1.0e4;
+  }
+
+  bool
+  compute_envelope(const sparse_matrix_type& a_matrix)
+  {
+    typedef typename sparse_matrix_type::const_iterator iterator;
+    const size_type size = a_matrix.n_rows;
+
+    // Each off-diagonal entry links two unknowns, just as an element links
+    // its vertices.
+    std::vector<size_type> offsets(1, 0);
+    std::vector<size_type> vertices;
+    double scale = 0.0;
+    for (iterator p = a_matrix.begin(); p != a_matrix.end(); ++p)
+    {
+      scale = std::max<double>(scale, std::abs(*p));
+      if (p.row() != p.col())
+      {
+        vertices.push_back(p.row());
+        vertices.push_back(p.col());
+        offsets.push_back(vertices.size());
+      }
+    }
+    m_order = reverse_cuthill_mckee(size, offsets, vertices);
+    std::vector<size_type> inverse(size);
+    for (size_type i = 0; i < size; ++i)
+    {
+      inverse[m_order[i]] = i;
+    }
+
+    // Row i of the envelope spans columns m_first[i] to i of the lower
+    // triangle, and rows m_first[i] to i of the upper one.
+    m_first.resize(size);
+    for (size_type i = 0; i < size; ++i)
+    {
+      m_first[i] = i;
+    }
+    for (iterator p = a_matrix.begin(); p != a_matrix.end(); ++p)
+    {
+      const size_type row = inverse[p.row()];
+      const size_type col = inverse[p.col()];
+      const size_type high = std::max(row, col);
+      m_first[high] = std::min(m_first[high], std::min(row, col));
+    }
+    m_offsets.resize(size + 1);
+    m_offsets[0] = 0;
+    for (size_type i = 0; i < size; ++i)
+    {
+      m_offsets[i + 1] = m_offsets[i] + (i - m_first[i]);
+    }
+
+    m_lower_values.assign(m_offsets[size], value_type(0));
+    m_upper_values.assign(m_offsets[size], value_type(0));
+    m_pivots_values.zeros(size);
+    std::vector<double> magnitudes(size, 0.0);
+    for (iterator p = a_matrix.begin(); p != a_matrix.end(); ++p)
+    {
+      const size_type row = inverse[p.row()];
+      const size_type col = inverse[p.col()];
+      const double magnitude = std::abs(*p);
+      magnitudes[row] = std::max(magnitudes[row], magnitude);
+      magnitudes[col] = std::max(magnitudes[col], magnitude);
+      if (row == col)
+      {
+        m_pivots_values(row) += *p;
+      }
+      else if (row > col)
+      {
+        m_lower_values[m_offsets[row] + col - m_first[row]] += *p;
+      }
+      else
+      {
+        m_upper_values[m_offsets[col] + row - m_first[col]] += *p;
+      }
+    }
+
+    // Doolittle elimination: L has a unit diagonal and U keeps the pivots.
+    const double threshold = get_pivot_threshold();
+    const double growth = get_growth_limit();
+    for (size_type i = 0; i < size; ++i)
+    {
+      value_type* lower_i = m_lower_values.data() + m_offsets[i];
+      value_type* upper_i = m_upper_values.data() + m_offsets[i];
+      for (size_type j = m_first[i]; j < i; ++j)
+      {
+        const size_type k0 = std::max(m_first[i], m_first[j]);
+        const value_type* lower_j = m_lower_values.data() + m_offsets[j];
+        const value_type* upper_j = m_upper_values.data() + m_offsets[j];
+        value_type l = lower_i[j - m_first[i]];
+        value_type u = upper_i[j - m_first[i]];
+        for (size_type k = k0; k < j; ++k)
+        {
+          l -= lower_i[k - m_first[i]] * upper_j[k - m_first[j]];
+          u -= lower_j[k - m_first[j]] * upper_i[k - m_first[i]];
+        }
+        l /= m_pivots_values(j);
+        if (!(std::abs(l) <= growth) || !(std::abs(u) <= growth * scale))
+        {
+          return false;
+        }
+        lower_i[j - m_first[i]] = l;
+        upper_i[j - m_first[i]] = u;
+      }
+      value_type d = m_pivots_values(i);
+      for (size_type k = m_first[i]; k < i; ++k)
+      {
+        d -= lower_i[k - m_first[i]] * upper_i[k - m_first[i]];
+      }
+      if (!(std::abs(d) > threshold * magnitudes[i])
+          || !(std::abs(d) <= growth * scale))
+      {
+        return false;
+      }
+      m_pivots_values(i) = d;
+    }
+    return true;
+  }
+
+  void
+  solve_envelope(vector_type& a_x, const vector_type& a_b) const
+  {
+    const size_type size = m_order.size();
+    m_work.set_size(size);
+    for (size_type i = 0; i < size; ++i)
+    {
+      const value_type* lower_i = m_lower_values.data() + m_offsets[i];
+      value_type y = a_b(m_order[i]);
+      for (size_type k = m_first[i]; k < i; ++k)
+      {
+        y -= lower_i[k - m_first[i]] * m_work(k);
+      }
+      m_work(i) = y;
+    }
+    for (size_type i = size; i-- > 0; )
+    {
+      const value_type* upper_i = m_upper_values.data() + m_offsets[i];
+      m_work(i) /= m_pivots_values(i);
+      for (size_type k = m_first[i]; k < i; ++k)
+      {
+        m_work(k) -= upper_i[k - m_first[i]] * m_work(i);
+      }
+    }
+    a_x.set_size(size);
+    for (size_type i = 0; i < size; ++i)
+    {
+      a_x(m_order[i]) = m_work(i);
+    }
+  }
+private:
+  bool m_valid;
+  bool m_cholesky;
+  bool m_diagonal;
+  bool m_sparse;
+  vector_type m_reciprocals;
+  matrix_type m_lower;
+  matrix_type m_upper;
+  index_type m_pivots;
+  std::vector<size_type> m_order;
+  std::vector<size_type> m_first;
+  std::vector<size_type> m_offsets;
+  std::vector<value_type> m_lower_values;
+  std::vector<value_type> m_upper_values;
+  vector_type m_pivots_values;
+  mutable vector_type m_work;
+}; // factorization<T> class
+
+} // yamss namespace
+
+#endif // YAMSS_FACTORIZATION_HPP
@@ -2,9 +2,11 @@
 #define YAMSS_HANDLER_HPP
 
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include "yamss/input_reader.hpp"
@@ -67,9 +69,23 @@ struct YamssException
   std::string what;
 };
 
+namespace server {
+class binary_server;
+class publisher;
+class shared_transport;
+} // server namespace
+
+// A handler may be shared by several server threads.  The table of jobs has
+// a lock of its own, and so does each job, so that calls on different jobs
+// run in parallel while calls on the same job are made one at a time.
+
 class handler
 {
 public:
+  friend class server::binary_server;
+  friend class server::publisher;
+  friend class server::shared_transport;
+
   handler(const boost::filesystem::path& a_directory);
 
   // Job management
@@ -153,21 +169,126 @@ public:
   setLoading(const JobKey& a_job,
              const std::int64_t a_loadKey,
              const InterfaceLoading& a_loading);
+
+  // Apply the loadings, take a step (or a subiteration), and return the
+  // movement of the requested loads, all in one call.
+
+  std::vector<InterfaceMovement>
+  exchange(const JobKey& a_job,
+           const std::vector<std::int64_t>& a_loadKeys,
+           const std::vector<InterfaceLoading>& a_loadings,
+           const bool a_subiterate,
+           const std::vector<std::int64_t>& a_movementKeys);
 protected:
   typedef size_t key_type;
   typedef size_t size_type;
   typedef ::yamss::runner<double> runner_type;
   typedef ::boost::shared_ptr<runner_type> runner_pointer;
-  typedef ::std::pair<runner_pointer, std::string> job_type;
-
-  runner_pointer
+  typedef ::arma::Mat<double> matrix_type;
+
+  struct job_type
+  {
+    runner_pointer runner;
+    std::string url;
+    std::mutex mutex;
+  };
+
+  typedef ::boost::shared_ptr<job_type> job_pointer;
+
+  // A runner_lock holds the lock of a job for as long as it lives, and
+  // otherwise behaves as a pointer to the runner of the job.
+
+  class runner_lock
+  {
+  public:
+    runner_lock(const job_pointer& a_job)
+      : m_job(a_job)
+      , m_lock(a_job->mutex)
+    {
+      // empty
+    }
+
+    runner_type*
+    operator->() const
+    {
+      return m_job->runner.get();
+    }
+
+    runner_type&
+    operator*() const
+    {
+      return *m_job->runner;
+    }
+
+    const std::string&
+    get_url() const
+    {
+      return m_job->url;
+    }
+  private:
+    job_pointer m_job;
+    std::unique_lock<std::mutex> m_lock;
+  }; // runner_lock class
+
+  job_pointer
+  get_job(const std::string& a_job);
+
+  runner_lock
   get_runner(const std::string& a_job);
+
+  // The rows of a_coordinates receive the positions of the nodes of the
+  // load, in the order of its begin_nodes().  a_types and a_vertices receive
+  // the shapes and vertices of its elements, with the vertices numbered in
+  // that same order.
+
+  void
+  get_interface(runner_type& a_runner,
+                const std::int64_t a_loadKey,
+                matrix_type& a_coordinates,
+                std::vector<std::int32_t>& a_types,
+                std::vector<std::int32_t>& a_vertices);
+
+  InterfaceMovement
+  get_movement(runner_type& a_runner, const std::int64_t a_loadKey);
+
+  // The columns of a_movement receive the displacements, velocities and
+  // accelerations of the load.
+
+  void
+  get_movement(runner_type& a_runner,
+               const std::int64_t a_loadKey,
+               matrix_type& a_movement);
+
+  // Throw unless a_loadKey names an interface load of the job that takes
+  // a_size pressures.  set_loading() checks the same, but a caller that
+  // applies several loadings checks them all first, so that a bad one
+  // leaves the job untouched.
+
+  void
+  check_loading(runner_type& a_runner,
+                const std::int64_t a_loadKey,
+                size_type a_size);
+
+  void
+  set_loading(runner_type& a_runner,
+              const std::int64_t a_loadKey,
+              const InterfaceLoading& a_loading);
+
+  // The pressures are read in place; they are not copied.
+
+  void
+  set_loading(runner_type& a_runner,
+              const std::int64_t a_loadKey,
+              const double* a_pressures,
+              size_type a_size);
 private:
-  typedef ::boost::unordered_map<std::string, job_type> jobs_type;
+  typedef ::boost::unordered_map<std::string, job_pointer> jobs_type;
 
   ::boost::filesystem::path m_directory;
   ::yamss::transporter m_transporter;
   jobs_type m_jobs;
+  std::mutex m_jobs_mutex;
+  std::mutex m_transporter_mutex;
 }; // handler class
 
 } // yamss namespace
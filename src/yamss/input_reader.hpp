@@ -4,6 +4,7 @@
 #include <limits>
 #include <stdexcept>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -12,6 +13,7 @@
 #include "yamss/runner.hpp"
 
 // Evaluators
+#include "yamss/evaluator/expression.hpp"
 #include "yamss/evaluator/interface.hpp"
 #include "yamss/evaluator/lua.hpp"
 
@@ -25,6 +27,7 @@
 // Integrators
 #include "yamss/integrator/generalized_alpha.hpp"
 #include "yamss/integrator/newmark_beta.hpp"
+#include "yamss/integrator/state_transition.hpp"
 #include "yamss/integrator/steady_state.hpp"
 
 namespace yamss {
@@ -37,7 +40,8 @@ public:
   typedef runner<T> runner_type;
 
   input_reader()
-    : m_eom()
+    : m_directory()
+    , m_eom()
     , m_structure()
     , m_integrator()
     , m_runner()
@@ -49,6 +53,7 @@ public:
     process_nodes();
     process_elements();
     process_grids();
+    process_ordering();
     process_modes();
     process_eom();
     process_loads();
@@ -57,7 +62,8 @@ public:
   }
 
   input_reader(const std::string& a_filename)
-    : m_eom()
+    : m_directory()
+    , m_eom()
     , m_structure()
     , m_integrator()
     , m_runner()
@@ -69,6 +75,7 @@ public:
     process_nodes();
     process_elements();
     process_grids();
+    process_ordering();
     process_modes();
     process_eom();
     process_loads();
@@ -105,6 +112,7 @@ protected:
     boost::property_tree::ptree document;
     boost::property_tree::read_xml(a_filename, document);
     m_document = document.get_child("yamss");
+    m_directory = boost::filesystem::path(a_filename).parent_path();
   }
 
   template <typename Integrator>
@@ -143,6 +151,10 @@ protected:
     {
       assign_integrator<integrator::steady_state<T> >(m_document);
     }
+    else if (type_ == "state_transition")
+    {
+      assign_integrator<integrator::state_transition<T> >(m_document);
+    }
     else
     {
       boost::format fmt("The integration method %1% is not supported");
@@ -165,7 +177,16 @@ protected:
     {
       // empty
     }
-    m_eom = boost::make_shared<eom_type>(num_modes, stencil_size);
+    typename eom_type::storage_type storage = eom_type::DENSE;
+    if (m_document.get_child_optional("eom.matrices.diagonal"))
+    {
+      storage = eom_type::DIAGONAL;
+    }
+    else if (m_document.get_child_optional("eom.matrices.sparse"))
+    {
+      storage = eom_type::SPARSE;
+    }
+    m_eom = boost::make_shared<eom_type>(num_modes, stencil_size, storage);
     m_structure = boost::make_shared<structure_type>(num_modes);
   }
 
@@ -203,7 +224,7 @@ protected:
       id = p->second.get_optional<key_type>("id");
       if (id)
       {
-        node_type& node_ = m_structure->add_node(*id);
+        node_type node_ = m_structure->add_node(*id);
         if ((dof = p->second.get_optional<value_type>("x")))
         {
           node_.set_position(0, *dof);
@@ -296,7 +317,7 @@ protected:
         if (id)
         {
           shape = get_shape(p->first);
-          element_type& element_ = m_structure->add_element(*id, shape);
+          element_type element_ = m_structure->add_element(*id, shape);
           add_vertices(element_, p->second);
         }
       }
@@ -401,7 +422,7 @@ protected:
                 +        u  * (1.0 - v) * vertices[1]
                 +        u  *        v  * vertices[2]
                 + (1.0 - u) *        v  * vertices[3];
-            node_type& node_ = m_structure->add_node(node_id);
+            node_type node_ = m_structure->add_node(node_id);
             node_.set_position(x);
             ++node_id;
           }
@@ -412,8 +433,8 @@ protected:
         {
           for (i = 0; i < i_dim - 1; ++i)
           {
-            n = i + i_dim * j + 1;
-            element_type& element_ = m_structure->add_element(elem_id, shape);
+            n = *id + i + i_dim * j;
+            element_type element_ = m_structure->add_element(elem_id, shape);
             element_.set_vertex(0, n);
             element_.set_vertex(1, n + 1);
             element_.set_vertex(2, n + i_dim + 1);
@@ -471,22 +492,41 @@ protected:
     }
   }
 
+  template <typename Evaluator>
   void
-  add_mode_with_lua(const boost::property_tree::ptree& a_tree,
-                    size_type a_mode)
+  add_mode_with_function(const boost::property_tree::ptree& a_tree,
+                         size_type a_mode)
   {
     typename structure_type::node_iterator node_p;
-    std::string type_ = a_tree.get<std::string>("type", "lua");
-    boost::to_lower(type_);
-    if (type_ == "lua")
-    {
-      evaluator::lua<value_type> evaluator_(a_tree);
-      for (node_p = m_structure->begin_nodes();
-           node_p != m_structure->end_nodes();
-           ++node_p)
-      {
-        node_p->set_mode(a_mode, evaluator_(node_p->get_position()));
-      }
+    Evaluator evaluator_(a_tree);
+    for (node_p = m_structure->begin_nodes();
+         node_p != m_structure->end_nodes();
+         ++node_p)
+    {
+      node_p->set_mode(a_mode, evaluator_(node_p->get_position()));
+    }
+  }
+
+  // The nodes are renumbered internally once they and the elements are all
+  // known, but before the mode shapes are read.
+
+  void
+  process_ordering()
+  {
+    const std::string keyword = m_document.get<std::string>(
+        "structure.ordering", "input");
+    if (keyword == "rcm")
+    {
+      m_structure->reorder_nodes(structure_type::REVERSE_CUTHILL_MCKEE);
+    }
+    else if (keyword == "morton")
+    {
+      m_structure->reorder_nodes(structure_type::MORTON);
+    }
+    else if (keyword != "input")
+    {
+      boost::format fmt("The node ordering %1% is not supported");
+      throw std::runtime_error(boost::str(fmt % keyword));
     }
   }
 
@@ -532,7 +572,11 @@ protected:
         boost::to_lower(type_);
         if (type_ == "lua")
         {
-          add_mode_with_lua(tree, mode_number);
+          add_mode_with_function<evaluator::lua<T> >(tree, mode_number);
+        }
+        else if (type_ == "expression")
+        {
+          add_mode_with_function<evaluator::expression<T> >(tree, mode_number);
         }
       }
       catch (pt::ptree_bad_path& e)
@@ -542,6 +586,44 @@ protected:
     }
   }
 
+  // A sparse matrix is either given inline or read from the file named by
+  // the file attribute, which holds one zero-based "row column value" triplet
+  // per line.  A relative file name is taken relative to the directory of
+  // the input file, or to the working directory when the input is read from
+  // standard input.
+
+  arma::SpMat<value_type>
+  get_sparse_matrix(const boost::property_tree::ptree& a_tree)
+  {
+    const size_type size = m_eom->get_size();
+    boost::optional<std::string> filename =
+        a_tree.get_optional<std::string>("<xmlattr>.file");
+    if (!filename)
+    {
+      return sparse_cast<value_type>(a_tree.data(), size, size);
+    }
+
+    boost::filesystem::path path(*filename);
+    if (path.is_relative())
+    {
+      path = m_directory / path;
+    }
+
+    arma::SpMat<value_type> mat;
+    if (!mat.load(path.string(), arma::coord_ascii))
+    {
+      boost::format fmt("Could not read the matrix file '%1%'");
+      throw std::runtime_error(boost::str(fmt % path.string()));
+    }
+    if (mat.n_rows > size || mat.n_cols > size)
+    {
+      boost::format fmt("The matrix in '%1%' is too large");
+      throw std::runtime_error(boost::str(fmt % path.string()));
+    }
+    mat.resize(size, size);
+    return mat;
+  }
+
   void
   process_eom()
   {
@@ -551,17 +633,50 @@ protected:
     try
     {
       tree = m_document.get_child("eom.matrices");
-      if ((str = tree.get_optional<std::string>("mass")))
+      if (m_eom->has_diagonal_storage())
       {
-        m_eom ->set_mass(matrix_cast<value_type>(*str));
+        if ((str = tree.get_optional<std::string>("mass")))
+        {
+          m_eom->set_mass_diagonal(diagonal_cast<value_type>(*str));
+        }
+        if ((str = tree.get_optional<std::string>("damping")))
+        {
+          m_eom->set_damping_diagonal(diagonal_cast<value_type>(*str));
+        }
+        if ((str = tree.get_optional<std::string>("stiffness")))
+        {
+          m_eom->set_stiffness_diagonal(diagonal_cast<value_type>(*str));
+        }
       }
-      if ((str = tree.get_optional<std::string>("damping")))
+      else if (m_eom->has_sparse_storage())
       {
-        m_eom->set_damping(matrix_cast<value_type>(*str));
+        if (tree.get_child_optional("mass"))
+        {
+          m_eom->set_mass(get_sparse_matrix(tree.get_child("mass")));
+        }
+        if (tree.get_child_optional("damping"))
+        {
+          m_eom->set_damping(get_sparse_matrix(tree.get_child("damping")));
+        }
+        if (tree.get_child_optional("stiffness"))
+        {
+          m_eom->set_stiffness(get_sparse_matrix(tree.get_child("stiffness")));
+        }
       }
-      if ((str = tree.get_optional<std::string>("stiffness")))
+      else
       {
-        m_eom->set_stiffness(matrix_cast<value_type>(*str));
+        if ((str = tree.get_optional<std::string>("mass")))
+        {
+          m_eom ->set_mass(matrix_cast<value_type>(*str));
+        }
+        if ((str = tree.get_optional<std::string>("damping")))
+        {
+          m_eom->set_damping(matrix_cast<value_type>(*str));
+        }
+        if ((str = tree.get_optional<std::string>("stiffness")))
+        {
+          m_eom->set_stiffness(matrix_cast<value_type>(*str));
+        }
       }
     }
     catch (boost::property_tree::ptree_bad_path& e)
@@ -727,6 +842,10 @@ protected:
         {
           add_load<evaluator::lua<T> >(*id, p->second);
         }
+        else if (*type_ == "expression")
+        {
+          add_load<evaluator::expression<T> >(*id, p->second);
+        }
         else
         {
           boost::format fmt("The load evaluator method %1% is not supported");
@@ -745,6 +864,8 @@ protected:
     value_type dt = m_document.get<value_type>("solution.time.step", 0.01);
     m_runner->set_time_step(dt);
     m_runner->set_final_time(t);
+    m_structure->set_number_of_threads(
+        m_document.get<size_type>("solution.threads", 1));
 
     pt::ptree dofs_tree;
     try
@@ -853,6 +974,7 @@ protected:
   }
 private:
   boost::property_tree::ptree m_document;
+  boost::filesystem::path m_directory;
 
   boost::shared_ptr<eom_type> m_eom;
   boost::shared_ptr<structure_type> m_structure;
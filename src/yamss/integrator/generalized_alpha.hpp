@@ -2,6 +2,7 @@
 #define YAMSS_GENERALIZED_ALPHA_HPP
 
 #include <armadillo>
+#include "yamss/factorization.hpp"
 #include "yamss/integrator/integrator.hpp"
 
 namespace yamss {
@@ -20,11 +21,17 @@ public:
   generalized_alpha()
     : m_alpha_m(0.0)
     , m_alpha_f(0.0)
+    , m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     compute_beta_and_gamma();
   }
 
   generalized_alpha(const boost::property_tree::ptree& a_tree)
+    : m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     m_alpha_m = a_tree.get<value_type>("alpha_m", 0.0);
     m_alpha_f = a_tree.get<value_type>("alpha_f", 0.0);
@@ -42,9 +49,6 @@ public:
   {
     const value_type t = a_eom.get_time(0);
     const value_type dt = a_eom.get_time_step(0);
-    const matrix_type& m = a_eom.get_mass();
-    const matrix_type& c = a_eom.get_damping();
-    const matrix_type& k = a_eom.get_stiffness();
     const vector_type& u = a_eom.get_displacement(1);
     const vector_type& du = a_eom.get_velocity(1);
     const vector_type& ddu = a_eom.get_acceleration(1);
@@ -68,23 +72,105 @@ public:
     value_type c7 = k0;
 
     a_structure.apply_loads(t - m_alpha_f * dt);
-    vector_type f = c7 * a_structure.get_generalized_force();
 
-    vector_type p = c0 * u + c2 * du + c3 * ddu;
-    vector_type q = c1 * u + c4 * du + c5 * ddu;
-    vector_type r = c6 * u;
-
-    matrix_type k_eff = k + c0 * m + c1 * c;
-    vector_type f_eff = f + m * p + c * q + k * r;
-
-    vector_type u_new;
-    arma::solve(u_new, k_eff, f_eff);
-    vector_type ddu_new = b0 * (u_new - u) - b1 * du - b2 * ddu;
-    vector_type du_new = du + a0 * ddu + a1 * ddu_new;
-
-    a_eom.set_displacement(u_new);
-    a_eom.set_velocity(du_new);
-    a_eom.set_acceleration(ddu_new);
+    if (a_eom.is_diagonal())
+    {
+      const vector_type& m = a_eom.get_mass_diagonal();
+      const vector_type& c = a_eom.get_damping_diagonal();
+      const vector_type& k = a_eom.get_stiffness_diagonal();
+      const vector_type& f = a_structure.get_generalized_force();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute_diagonal(k + c0 * m + c1 * c);
+        set_current(a_eom, dt);
+      }
+
+      // Each mode is an independent scalar recurrence.  The loop runs over
+      // raw arrays so that the compiler is free to vectorize it.
+      const size_type size = a_eom.get_size();
+      m_displacement.set_size(size);
+      m_velocity.set_size(size);
+      m_acceleration.set_size(size);
+      m_force.set_size(size);
+      const value_type* u0 = u.memptr();
+      const value_type* du0 = du.memptr();
+      const value_type* ddu0 = ddu.memptr();
+      const value_type* f1 = f.memptr();
+      const value_type* mm = m.memptr();
+      const value_type* cc = c.memptr();
+      const value_type* kk = k.memptr();
+      const value_type* rr = m_factorization.get_reciprocals().memptr();
+      value_type* u1 = m_displacement.memptr();
+      value_type* du1 = m_velocity.memptr();
+      value_type* ddu1 = m_acceleration.memptr();
+      value_type* f2 = m_force.memptr();
+      for (size_type n = 0; n < size; ++n)
+      {
+        const value_type p = c0 * u0[n] + c2 * du0[n] + c3 * ddu0[n];
+        const value_type q = c1 * u0[n] + c4 * du0[n] + c5 * ddu0[n];
+        const value_type r = c6 * u0[n];
+        const value_type u_new =
+            (c7 * f1[n] + mm[n] * p + cc[n] * q + kk[n] * r) * rr[n];
+        const value_type ddu_new = b0 * (u_new - u0[n])
+            - b1 * du0[n] - b2 * ddu0[n];
+        const value_type du_new = du0[n] + a0 * ddu0[n] + a1 * ddu_new;
+        u1[n] = u_new;
+        du1[n] = du_new;
+        ddu1[n] = ddu_new;
+        f2[n] = mm[n] * ddu_new + cc[n] * du_new + kk[n] * u_new;
+      }
+
+      a_eom.set_displacement(m_displacement);
+      a_eom.set_velocity(m_velocity);
+      a_eom.set_acceleration(m_acceleration);
+      a_eom.set_force(m_force);
+      return;
+    }
+
+    m_p = c0 * u + c2 * du + c3 * ddu;
+    m_q = c1 * u + c4 * du + c5 * ddu;
+    m_r = c6 * u;
+    m_force = c7 * a_structure.get_generalized_force();
+
+    if (a_eom.has_sparse_storage())
+    {
+      const sparse_matrix_type& m = a_eom.get_sparse_mass();
+      const sparse_matrix_type& c = a_eom.get_sparse_damping();
+      const sparse_matrix_type& k = a_eom.get_sparse_stiffness();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute(sparse_matrix_type(k + c0 * m + c1 * c));
+        set_current(a_eom, dt);
+      }
+      m_force += m * m_p;
+      m_force += c * m_q;
+      m_force += k * m_r;
+    }
+    else
+    {
+      const matrix_type& m = a_eom.get_mass();
+      const matrix_type& c = a_eom.get_damping();
+      const matrix_type& k = a_eom.get_stiffness();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute(k + c0 * m + c1 * c);
+        set_current(a_eom, dt);
+      }
+      m_force += m * m_p;
+      m_force += c * m_q;
+      m_force += k * m_r;
+    }
+
+    m_factorization.solve(m_displacement, m_force);
+    m_acceleration = b0 * (m_displacement - u) - b1 * du - b2 * ddu;
+    m_velocity = du + a0 * ddu + a1 * m_acceleration;
+
+    a_eom.set_displacement(m_displacement);
+    a_eom.set_velocity(m_velocity);
+    a_eom.set_acceleration(m_acceleration);
     a_eom.compute_force();
   }
 
@@ -101,15 +187,35 @@ protected:
     m_gamma = 0.5 - m_alpha_m + m_alpha_f;
     m_beta = 0.0625 + 0.25 * m_gamma * (1.0 + m_gamma);
   }
+
+  bool
+  is_current(const eom_type& a_eom, const value_type& a_time_step) const
+  {
+    return m_factorization.is_valid()
+        && m_time_step == a_time_step
+        && m_version == a_eom.get_version();
+  }
+
+  void
+  set_current(const eom_type& a_eom, const value_type& a_time_step)
+  {
+    m_time_step = a_time_step;
+    m_version = a_eom.get_version();
+  }
 private:
   typedef arma::Col<T> vector_type;
   typedef arma::Mat<T> matrix_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+  typedef factorization<T> factorization_type;
 
   generalized_alpha(const generalized_alpha& a_other)
     : m_alpha_m(a_other.m_alpha_m)
     , m_alpha_f(a_other.m_alpha_f)
     , m_beta(a_other.m_beta)
     , m_gamma(a_other.m_gamma)
+    , m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     // empty
   }
@@ -121,6 +227,7 @@ private:
     m_alpha_f = a_other.m_alpha_f;
     m_beta = a_other.m_beta;
     m_gamma = a_other.m_gamma;
+    m_factorization.reset();
     return *this;
   }
 
@@ -128,6 +235,16 @@ private:
   value_type m_alpha_f;
   value_type m_beta;
   value_type m_gamma;
+  value_type m_time_step;
+  size_type m_version;
+  factorization_type m_factorization;
+  vector_type m_displacement;
+  vector_type m_velocity;
+  vector_type m_acceleration;
+  vector_type m_force;
+  vector_type m_p;
+  vector_type m_q;
+  vector_type m_r;
 }; // generalized_alpha<T> class
 
 } // integrator namespace
@@ -2,6 +2,7 @@
 #define YAMSS_NEWMARK_BETA_HPP
 
 #include <armadillo>
+#include "yamss/factorization.hpp"
 #include "yamss/integrator/integrator.hpp"
 
 namespace yamss {
@@ -20,11 +21,17 @@ public:
   newmark_beta()
     : m_beta(0.25)
     , m_gamma(0.5)
+    , m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     // empty
   }
 
   newmark_beta(const boost::property_tree::ptree& a_tree)
+    : m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     m_beta = a_tree.get<value_type>("beta", 0.25);
     m_gamma = a_tree.get<value_type>("gamma", 0.5);
@@ -41,9 +48,6 @@ public:
   {
     const value_type t = a_eom.get_time(0);
     const value_type dt = a_eom.get_time_step(0);
-    const matrix_type& m = a_eom.get_mass();
-    const matrix_type& c = a_eom.get_damping();
-    const matrix_type& k = a_eom.get_stiffness();
     const vector_type& u = a_eom.get_displacement(1);
     const vector_type& du = a_eom.get_velocity(1);
     const vector_type& ddu = a_eom.get_acceleration(1);
@@ -61,20 +65,92 @@ public:
     a_eom.set_force(a_structure.get_generalized_force());
     const vector_type& f = a_eom.get_force(0);
 
-    vector_type v = a0 * u + a2 * du + a3 * ddu;
-    vector_type w = a1 * u + a4 * du + a5 * ddu;
-
-    matrix_type k_eff = k + a0 * m + a1 * c;
-    vector_type f_eff = f + m * v + c * w;
-
-    vector_type u_new;
-    arma::solve(u_new, k_eff, f_eff);
-    vector_type ddu_new = a0 * (u_new - u) - a2 * du - a3 * ddu;
-    vector_type du_new = du + a6 * ddu + a7 * ddu_new;
-
-    a_eom.set_displacement(u_new);
-    a_eom.set_velocity(du_new);
-    a_eom.set_acceleration(ddu_new);
+    if (a_eom.is_diagonal())
+    {
+      const vector_type& m = a_eom.get_mass_diagonal();
+      const vector_type& c = a_eom.get_damping_diagonal();
+      const vector_type& k = a_eom.get_stiffness_diagonal();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute_diagonal(k + a0 * m + a1 * c);
+        set_current(a_eom, dt);
+      }
+
+      // Each mode is an independent scalar recurrence.  The loop runs over
+      // raw arrays so that the compiler is free to vectorize it.
+      const size_type size = a_eom.get_size();
+      m_displacement.set_size(size);
+      m_velocity.set_size(size);
+      m_acceleration.set_size(size);
+      const value_type* u0 = u.memptr();
+      const value_type* du0 = du.memptr();
+      const value_type* ddu0 = ddu.memptr();
+      const value_type* f1 = f.memptr();
+      const value_type* mm = m.memptr();
+      const value_type* cc = c.memptr();
+      const value_type* kk = m_factorization.get_reciprocals().memptr();
+      value_type* u1 = m_displacement.memptr();
+      value_type* du1 = m_velocity.memptr();
+      value_type* ddu1 = m_acceleration.memptr();
+      for (size_type n = 0; n < size; ++n)
+      {
+        const value_type v = a0 * u0[n] + a2 * du0[n] + a3 * ddu0[n];
+        const value_type w = a1 * u0[n] + a4 * du0[n] + a5 * ddu0[n];
+        const value_type u_new = (f1[n] + mm[n] * v + cc[n] * w) * kk[n];
+        const value_type ddu_new = a0 * (u_new - u0[n])
+            - a2 * du0[n] - a3 * ddu0[n];
+        u1[n] = u_new;
+        du1[n] = du0[n] + a6 * ddu0[n] + a7 * ddu_new;
+        ddu1[n] = ddu_new;
+      }
+
+      a_eom.set_displacement(m_displacement);
+      a_eom.set_velocity(m_velocity);
+      a_eom.set_acceleration(m_acceleration);
+      return;
+    }
+
+    m_v = a0 * u + a2 * du + a3 * ddu;
+    m_w = a1 * u + a4 * du + a5 * ddu;
+    m_f = f;
+
+    if (a_eom.has_sparse_storage())
+    {
+      const sparse_matrix_type& m = a_eom.get_sparse_mass();
+      const sparse_matrix_type& c = a_eom.get_sparse_damping();
+      const sparse_matrix_type& k = a_eom.get_sparse_stiffness();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute(sparse_matrix_type(k + a0 * m + a1 * c));
+        set_current(a_eom, dt);
+      }
+      m_f += m * m_v;
+      m_f += c * m_w;
+    }
+    else
+    {
+      const matrix_type& m = a_eom.get_mass();
+      const matrix_type& c = a_eom.get_damping();
+      const matrix_type& k = a_eom.get_stiffness();
+
+      if (!is_current(a_eom, dt))
+      {
+        m_factorization.compute(k + a0 * m + a1 * c);
+        set_current(a_eom, dt);
+      }
+      m_f += m * m_v;
+      m_f += c * m_w;
+    }
+
+    m_factorization.solve(m_displacement, m_f);
+    m_acceleration = a0 * (m_displacement - u) - a2 * du - a3 * ddu;
+    m_velocity = du + a6 * ddu + a7 * m_acceleration;
+
+    a_eom.set_displacement(m_displacement);
+    a_eom.set_velocity(m_velocity);
+    a_eom.set_acceleration(m_acceleration);
   }
 
   virtual
@@ -83,13 +159,33 @@ public:
   {
     return 2;
   }
+protected:
+  bool
+  is_current(const eom_type& a_eom, const value_type& a_time_step) const
+  {
+    return m_factorization.is_valid()
+        && m_time_step == a_time_step
+        && m_version == a_eom.get_version();
+  }
+
+  void
+  set_current(const eom_type& a_eom, const value_type& a_time_step)
+  {
+    m_time_step = a_time_step;
+    m_version = a_eom.get_version();
+  }
 private:
   typedef arma::Col<T> vector_type;
   typedef arma::Mat<T> matrix_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+  typedef factorization<T> factorization_type;
 
   newmark_beta(const newmark_beta& a_other)
     : m_beta(a_other.m_beta)
     , m_gamma(a_other.m_gamma)
+    , m_time_step(0.0)
+    , m_version(0)
+    , m_factorization()
   {
     // empty
   }
@@ -99,11 +195,21 @@ private:
   {
     m_beta = a_other.m_beta;
     m_gamma = a_other.m_gamma;
+    m_factorization.reset();
     return *this;
   }
 
   value_type m_beta;
   value_type m_gamma;
+  value_type m_time_step;
+  size_type m_version;
+  factorization_type m_factorization;
+  vector_type m_displacement;
+  vector_type m_velocity;
+  vector_type m_acceleration;
+  vector_type m_v;
+  vector_type m_w;
+  vector_type m_f;
 }; // newmark_beta<T> class
 
 } // integrator namespace
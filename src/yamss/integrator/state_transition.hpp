@@ -0,0 +1,160 @@
+#ifndef YAMSS_STATE_TRANSITION_HPP
+#define YAMSS_STATE_TRANSITION_HPP
+
+#include <armadillo>
+#include "yamss/integrator/integrator.hpp"
+
+namespace yamss {
+namespace integrator {
+
+template <typename T = double>
+class state_transition : public integrator<T>
+{
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef const T& const_reference;
+  typedef eom<T> eom_type;
+  typedef structure<T> structure_type;
+
+  state_transition()
+    : m_time_step(0.0)
+    , m_version(0)
+    , m_valid(false)
+  {
+    // empty
+  }
+
+  state_transition(const boost::property_tree::ptree& a_tree)
+    : m_time_step(0.0)
+    , m_version(0)
+    , m_valid(false)
+  {
+    // empty
+  }
+
+  ~state_transition()
+  {
+    // empty
+  }
+
+  virtual
+  void
+  operator()(eom_type& a_eom, structure_type& a_structure)
+  {
+    const value_type t = a_eom.get_time(0);
+    const value_type dt = a_eom.get_time_step(0);
+    const size_type n = a_eom.get_size();
+
+    a_structure.apply_loads(t);
+    a_eom.set_force(a_structure.get_generalized_force());
+
+    if (!m_valid || m_time_step != dt || m_version != a_eom.get_version())
+    {
+      compute_propagator(a_eom, dt);
+    }
+
+    // The input and output blocks are stored column by column, so the same
+    // memory can be used as one long vector in the product.
+    m_input.set_size(n, 4);
+    m_input.col(0) = a_eom.get_displacement(1);
+    m_input.col(1) = a_eom.get_velocity(1);
+    m_input.col(2) = a_eom.get_force(1);
+    m_input.col(3) = a_eom.get_force(0);
+    const vector_type input(m_input.memptr(), 4 * n, false, true);
+
+    m_output.set_size(n, 3);
+    vector_type output(m_output.memptr(), 3 * n, false, true);
+    output = m_propagator * input;
+
+    a_eom.set_displacement(m_output.unsafe_col(0));
+    a_eom.set_velocity(m_output.unsafe_col(1));
+    a_eom.set_acceleration(m_output.unsafe_col(2));
+  }
+
+  virtual
+  size_type
+  stencil_size() const
+  {
+    return 2;
+  }
+protected:
+  void
+  compute_propagator(const eom_type& a_eom, const_reference a_time_step)
+  {
+    // The loads are assumed to vary linearly over the step, so the state
+    // x = {u, du} is propagated exactly by
+    //
+    //   x1 = Phi x0 + (Gamma0 - Gamma1) f0 + Gamma1 f1,
+    //
+    // where the three blocks come from the exponential of an augmented
+    // matrix (Van Loan, 1978).  The acceleration follows from the equations
+    // of motion, which adds one more block row to the propagator.
+    const size_type n = a_eom.get_size();
+    const value_type h = a_time_step;
+
+    m_propagator.zeros(3 * n, 4 * n);
+    if (n > 0)
+    {
+      const matrix_type& m = a_eom.get_mass();
+      const matrix_type identity = arma::eye<matrix_type>(n, n);
+      const matrix_type inv_m = arma::solve(m, identity);
+      matrix_type a(n, 2 * n);
+      a.cols(0, n - 1) = -inv_m * a_eom.get_stiffness();
+      a.cols(n, 2 * n - 1) = -inv_m * a_eom.get_damping();
+
+      matrix_type augmented(4 * n, 4 * n);
+      augmented.zeros();
+      augmented.submat(0, n, n - 1, 2 * n - 1) = h * identity;
+      augmented.submat(n, 0, 2 * n - 1, 2 * n - 1) = h * a;
+      augmented.submat(n, 2 * n, 2 * n - 1, 3 * n - 1) = h * inv_m;
+      augmented.submat(2 * n, 3 * n, 3 * n - 1, 4 * n - 1) = identity;
+
+      const matrix_type e = arma::expmat(augmented);
+      const matrix_type gamma0 = e.submat(0, 2 * n, 2 * n - 1, 3 * n - 1);
+      const matrix_type gamma1 = e.submat(0, 3 * n, 2 * n - 1, 4 * n - 1);
+
+      m_propagator.submat(0, 0, 2 * n - 1, 2 * n - 1) =
+          e.submat(0, 0, 2 * n - 1, 2 * n - 1);
+      m_propagator.submat(0, 2 * n, 2 * n - 1, 3 * n - 1) = gamma0 - gamma1;
+      m_propagator.submat(0, 3 * n, 2 * n - 1, 4 * n - 1) = gamma1;
+      m_propagator.rows(2 * n, 3 * n - 1) =
+          a * m_propagator.rows(0, 2 * n - 1);
+      m_propagator.submat(2 * n, 3 * n, 3 * n - 1, 4 * n - 1) += inv_m;
+    }
+
+    m_time_step = a_time_step;
+    m_version = a_eom.get_version();
+    m_valid = true;
+  }
+private:
+  typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+
+  state_transition(const state_transition& a_other)
+    : m_time_step(0.0)
+    , m_version(0)
+    , m_valid(false)
+  {
+    // empty
+  }
+
+  state_transition&
+  operator=(const state_transition& a_other)
+  {
+    m_valid = false;
+    return *this;
+  }
+
+  value_type m_time_step;
+  size_type m_version;
+  bool m_valid;
+  matrix_type m_propagator;
+  matrix_type m_input;
+  matrix_type m_output;
+}; // state_transition<T> class
+
+} // integrator namespace
+} // yamss namespace
+
+#endif // YAMSS_STATE_TRANSITION_HPP
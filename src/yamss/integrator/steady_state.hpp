@@ -2,6 +2,7 @@
 #define YAMSS_STEADY_STATE_HPP
 
 #include <armadillo>
+#include "yamss/factorization.hpp"
 #include "yamss/integrator/integrator.hpp"
 
 namespace yamss {
@@ -17,11 +18,15 @@ public:
   typedef structure<T> structure_type;
 
   steady_state()
+    : m_version(0)
+    , m_factorization()
   {
     // empty
   }
 
   steady_state(const boost::property_tree::ptree& a_tree)
+    : m_version(0)
+    , m_factorization()
   {
     // empty
   }
@@ -36,19 +41,34 @@ public:
   operator()(eom_type& a_eom, structure_type& a_structure)
   {
     const value_type t = a_eom.get_time(0);
-    const matrix_type& k = a_eom.get_stiffness();
 
     a_structure.apply_loads(t);
     a_eom.set_force(a_structure.get_generalized_force());
     const vector_type& f = a_eom.get_force(0);
 
-    vector_type u;
-    arma::solve(u, k, f);
-    a_eom.set_displacement(u);
+    if (!m_factorization.is_valid() || m_version != a_eom.get_version())
+    {
+      if (a_eom.is_diagonal())
+      {
+        m_factorization.compute_diagonal(a_eom.get_stiffness_diagonal());
+      }
+      else if (a_eom.has_sparse_storage())
+      {
+        m_factorization.compute(a_eom.get_sparse_stiffness());
+      }
+      else
+      {
+        m_factorization.compute(a_eom.get_stiffness());
+      }
+      m_version = a_eom.get_version();
+    }
 
-    u.zeros();
-    a_eom.set_velocity(u);
-    a_eom.set_acceleration(u);
+    m_factorization.solve(m_displacement, f);
+    a_eom.set_displacement(m_displacement);
+
+    m_zeros.zeros(f.n_elem);
+    a_eom.set_velocity(m_zeros);
+    a_eom.set_acceleration(m_zeros);
   }
 
   virtual
@@ -60,6 +80,12 @@ public:
 private:
   typedef arma::Col<T> vector_type;
   typedef arma::Mat<T> matrix_type;
+  typedef factorization<T> factorization_type;
+
+  size_type m_version;
+  factorization_type m_factorization;
+  vector_type m_displacement;
+  vector_type m_zeros;
 }; // steady_state<T> class
 
 } // integrator namespace
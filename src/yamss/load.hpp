@@ -2,6 +2,7 @@
 #define YAMSS_LOAD_HPP
 
 #include <algorithm>
+#include <vector>
 #include <armadillo>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
@@ -25,11 +26,18 @@ public:
   typedef evaluator::evaluator<T> evaluator_type;
   typedef boost::shared_ptr<evaluator_type> evaluator_pointer;
   typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+  typedef typename evaluator_type::nodes_type nodes_type;
   typedef typename set_type::const_iterator const_iterator;
+  typedef std::vector<size_type> indices_type;
 
   load(key_type a_key, const boost::shared_ptr<evaluator_type>& a_evaluator)
     : m_key(a_key)
     , m_evaluator(a_evaluator)
+    , m_indices_valid(false)
+    , m_pressure_valid(false)
+    , m_modes_valid(false)
   {
     // empty
   }
@@ -39,6 +47,13 @@ public:
     , m_nodes(a_other.m_nodes)
     , m_elements(a_other.m_elements)
     , m_evaluator(a_other.m_evaluator)
+    , m_pool(a_other.m_pool)
+    , m_indices(a_other.m_indices)
+    , m_indices_valid(a_other.m_indices_valid)
+    , m_pressure_operator(a_other.m_pressure_operator)
+    , m_pressure_valid(a_other.m_pressure_valid)
+    , m_modes(a_other.m_modes)
+    , m_modes_valid(a_other.m_modes_valid)
   {
     // empty
   }
@@ -55,6 +70,13 @@ public:
     m_nodes = a_other.m_nodes;
     m_elements = a_other.m_elements;
     m_evaluator = a_other.m_evaluator;
+    m_pool = a_other.m_pool;
+    m_indices = a_other.m_indices;
+    m_indices_valid = a_other.m_indices_valid;
+    m_pressure_operator = a_other.m_pressure_operator;
+    m_pressure_valid = a_other.m_pressure_valid;
+    m_modes = a_other.m_modes;
+    m_modes_valid = a_other.m_modes_valid;
     return *this;
   }
 
@@ -94,6 +116,9 @@ public:
     {
       m_nodes.insert(*p);
     }
+    m_indices_valid = false;
+    m_pressure_valid = false;
+    m_modes_valid = false;
   }
 
   template <typename Iterator>
@@ -127,11 +152,170 @@ public:
     return m_nodes.end();
   }
 
+  bool
+  has_node_indices() const
+  {
+    return m_indices_valid;
+  }
+
+  const indices_type&
+  get_node_indices() const
+  {
+    return m_indices;
+  }
+
+  void
+  set_node_indices(const indices_type& a_indices)
+  {
+    m_indices = a_indices;
+    std::sort(m_indices.begin(), m_indices.end());
+    m_indices_valid = true;
+    m_evaluator->invalidate_nodes();
+    for (size_type n = 0; n < m_pool.size(); ++n)
+    {
+      m_pool[n]->invalidate_nodes();
+    }
+  }
+
+  void
+  invalidate_node_indices()
+  {
+    m_indices_valid = false;
+  }
+
+  // The pressure operator maps a pressure at each node of the load, in the
+  // order of begin_nodes(), to the three force components at each of those
+  // nodes.  The structure builds it from the element geometry.
+
+  bool
+  has_pressure_operator() const
+  {
+    return m_pressure_valid;
+  }
+
+  const sparse_matrix_type&
+  get_pressure_operator() const
+  {
+    return m_pressure_operator;
+  }
+
+  void
+  set_pressure_operator(const sparse_matrix_type& a_operator)
+  {
+    m_pressure_operator = a_operator;
+    m_pressure_valid = true;
+  }
+
+  void
+  invalidate_pressure_operator()
+  {
+    m_pressure_valid = false;
+  }
+
+  // The mode matrix has one row for each active degree of freedom of each
+  // node of the load and one column for each mode.  The rows for the first
+  // active degree of freedom come first, with the nodes in the order of
+  // begin_nodes(), followed by those for the next active degree of freedom,
+  // and so on.
+
+  bool
+  has_modes() const
+  {
+    return m_modes_valid;
+  }
+
+  const matrix_type&
+  get_modes() const
+  {
+    return m_modes;
+  }
+
+  void
+  set_modes(const matrix_type& a_modes)
+  {
+    m_modes = a_modes;
+    m_modes_valid = true;
+  }
+
+  void
+  invalidate_modes()
+  {
+    m_modes_valid = false;
+  }
+
   vector_type
   apply(const value_type& a_time, const node_type& a_node) const
   {
     return m_evaluator->operator()(a_time, a_node);
   }
+
+  // Thread 0 always uses the original evaluator.  Threads 1 to n - 1 use
+  // clones of it when the evaluator cannot be shared; see reserve_threads().
+  // Column n of a_forces receives the load on node get_node_indices()[n].
+
+  void
+  evaluate(const value_type& a_time,
+           const nodes_type& a_nodes,
+           size_type a_begin,
+           size_type a_end,
+           size_type a_thread,
+           matrix_type& a_forces) const
+  {
+    const evaluator_pointer& evaluator_ =
+        (a_thread == 0 || m_pool.empty()) ? m_evaluator : m_pool[a_thread - 1];
+    evaluator_->evaluate(a_time, a_nodes, m_indices, a_begin, a_end, a_forces);
+  }
+
+  size_type
+  get_version() const
+  {
+    return m_evaluator->get_version();
+  }
+
+  bool
+  is_time_dependent() const
+  {
+    return m_evaluator->is_time_dependent();
+  }
+
+  bool
+  is_separable() const
+  {
+    return m_evaluator->is_separable();
+  }
+
+  value_type
+  get_scale(const value_type& a_time) const
+  {
+    return m_evaluator->get_scale(a_time);
+  }
+
+  void
+  evaluate_shape(const nodes_type& a_nodes, matrix_type& a_forces) const
+  {
+    m_evaluator->evaluate_shape(a_nodes, m_indices, 0, m_indices.size(),
+                                a_forces);
+  }
+
+  void
+  reserve_threads(size_type a_number_of_threads)
+  {
+    if (a_number_of_threads < 2 || m_pool.size() + 1 >= a_number_of_threads)
+    {
+      return;
+    }
+    evaluator_pointer copy = m_evaluator->clone();
+    if (!copy)
+    {
+      return;
+    }
+    m_pool.reserve(a_number_of_threads - 1);
+    m_pool.push_back(copy);
+    while (m_pool.size() + 1 < a_number_of_threads)
+    {
+      m_pool.push_back(m_evaluator->clone());
+    }
+  }
 private:
   load()
   {
@@ -142,6 +326,13 @@ private:
   set_type m_nodes;
   set_type m_elements;
   evaluator_pointer m_evaluator;
+  std::vector<evaluator_pointer> m_pool;
+  indices_type m_indices;
+  bool m_indices_valid;
+  sparse_matrix_type m_pressure_operator;
+  bool m_pressure_valid;
+  matrix_type m_modes;
+  bool m_modes_valid;
 }; // load<T> class
 
 } // yamss namespace
@@ -2,7 +2,9 @@
 #define YAMSS_MATRIX_CAST_HPP
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include <armadillo>
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
@@ -104,6 +106,92 @@ matrix_cast(const std::string& a_string)
   return mat;
 }
 
+template <typename T>
+arma::Col<T>
+diagonal_cast(const std::string& a_string)
+{
+  typedef size_t size_type;
+  typedef arma::Mat<T> matrix_type;
+
+  boost::smatch match;
+  boost::regex re("^\\s*diag\\(\\s*(?<vector>.*)\\s*\\)\\s*$");
+  if (boost::regex_match(a_string, match, re))
+  {
+    return vector_cast<T>(match["vector"]);
+  }
+
+  matrix_type mat = matrix_cast<T>(a_string);
+  for (size_type col = 0; col < mat.n_cols; ++col)
+  {
+    for (size_type row = 0; row < mat.n_rows; ++row)
+    {
+      if (row != col && mat(row, col) != T(0))
+      {
+        throw std::runtime_error("Expected a diagonal matrix");
+      }
+    }
+  }
+  return mat.diag();
+}
+
+// Sparse matrices are written as sparse(row col value ; ...), with zero-based
+// indices; entries that are not listed are zero.  The dense and diag() forms
+// are accepted as well.
+
+template <typename T>
+arma::SpMat<T>
+sparse_cast(const std::string& a_string, size_t a_rows, size_t a_cols)
+{
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+  typedef boost::char_separator<char> separator_type;
+  typedef boost::tokenizer<separator_type> tokenizer_type;
+
+  boost::smatch match;
+  boost::regex re("^\\s*sparse\\(\\s*(?<entries>.*)\\s*\\)\\s*$");
+  if (!boost::regex_match(a_string, match, re))
+  {
+    sparse_matrix_type mat(matrix_cast<T>(a_string));
+    if (mat.n_rows != a_rows || mat.n_cols != a_cols)
+    {
+      throw std::runtime_error("The matrix has the wrong size");
+    }
+    return mat;
+  }
+
+  separator_type separator(" ;\t\r\n");
+  std::string entries = match["entries"];
+  tokenizer_type tokens(entries, separator);
+  std::vector<std::string> cells(tokens.begin(), tokens.end());
+  if (cells.size() % 3 != 0)
+  {
+    throw std::runtime_error("Expected a row, column, and value");
+  }
+
+  // The entries are collected first and the matrix is built in one go,
+  // which sums repeated entries.  Inserting the entries one by one would
+  // move the entries after each of them every time.
+  const size_type n_entries = cells.size() / 3;
+  arma::umat locations(2, n_entries);
+  arma::Col<T> values(n_entries);
+  for (size_type n = 0; n < n_entries; ++n)
+  {
+    size_type row = boost::lexical_cast<size_type>(cells[3 * n]);
+    size_type col = boost::lexical_cast<size_type>(cells[3 * n + 1]);
+    value_type value = boost::lexical_cast<value_type>(cells[3 * n + 2]);
+    if (row >= a_rows || col >= a_cols)
+    {
+      throw std::runtime_error("The matrix entry is out of range");
+    }
+    locations(0, n) = row;
+    locations(1, n) = col;
+    values(n) = value;
+  }
+  return sparse_matrix_type(true, locations, values, a_rows, a_cols, true,
+                            true);
+}
+
 } // yamss namespace
 
 #endif // YAMSS_MATRIX_CAST_HPP
@@ -1,10 +1,190 @@
 #ifndef YAMSS_NODE_HPP
 #define YAMSS_NODE_HPP
 
+#include <algorithm>
+#include <vector>
 #include <armadillo>
 
 namespace yamss {
 
+template <typename T>
+class node_storage
+{
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef arma::Mat<T> matrix_type;
+
+  node_storage(size_type a_number_of_modes)
+    : m_number_of_modes(a_number_of_modes)
+    , m_size(0)
+    , m_positions_version(0)
+    , m_forces_version(0)
+    , m_modes_version(0)
+  {
+    // empty
+  }
+
+  ~node_storage()
+  {
+    // empty
+  }
+
+  size_type
+  get_size() const
+  {
+    return m_size;
+  }
+
+  size_type
+  get_number_of_modes() const
+  {
+    return m_number_of_modes;
+  }
+
+  size_type
+  add()
+  {
+    m_positions.resize(6 * (m_size + 1), value_type(0));
+    m_forces.resize(6 * (m_size + 1), value_type(0));
+    m_modes.resize(6 * m_number_of_modes * (m_size + 1), value_type(0));
+    touch_positions();
+    touch_modes();
+    return m_size++;
+  }
+
+  // The versions change whenever a position, force or mode shape is
+  // modified through a node, so that quantities derived from them can be
+  // cached.
+
+  size_type
+  get_positions_version() const
+  {
+    return m_positions_version;
+  }
+
+  size_type
+  get_forces_version() const
+  {
+    return m_forces_version;
+  }
+
+  size_type
+  get_modes_version() const
+  {
+    return m_modes_version;
+  }
+
+  void
+  touch_positions()
+  {
+    ++m_positions_version;
+  }
+
+  void
+  touch_forces()
+  {
+    ++m_forces_version;
+  }
+
+  void
+  touch_modes()
+  {
+    ++m_modes_version;
+  }
+
+  value_type*
+  get_position(size_type a_index)
+  {
+    return m_positions.data() + 6 * a_index;
+  }
+
+  value_type*
+  get_force(size_type a_index)
+  {
+    return m_forces.data() + 6 * a_index;
+  }
+
+  value_type*
+  get_modes(size_type a_index)
+  {
+    return m_modes.data() + 6 * m_number_of_modes * a_index;
+  }
+
+  // The matrices below are read-only views of the underlying arrays.  They
+  // are only valid until the next node is added.
+
+  const matrix_type
+  get_positions() const
+  {
+    return matrix_type(const_cast<value_type*>(m_positions.data()),
+                       6, m_size, false, true);
+  }
+
+  const matrix_type
+  get_forces() const
+  {
+    return matrix_type(const_cast<value_type*>(m_forces.data()),
+                       6, m_size, false, true);
+  }
+
+  const matrix_type
+  get_modes() const
+  {
+    return matrix_type(const_cast<value_type*>(m_modes.data()),
+                       m_number_of_modes, 6 * m_size, false, true);
+  }
+
+  void
+  clear_forces()
+  {
+    std::fill(m_forces.begin(), m_forces.end(), value_type(0));
+  }
+
+  // Rearrange the nodes so that the node at index a_order[i] moves to index
+  // i.  Nodes referring to the old indices must be rebuilt.
+
+  void
+  permute(const std::vector<size_type>& a_order)
+  {
+    permute(m_positions, a_order, 6);
+    permute(m_forces, a_order, 6);
+    permute(m_modes, a_order, 6 * m_number_of_modes);
+    touch_positions();
+    touch_modes();
+  }
+private:
+  node_storage(const node_storage& a_other);
+
+  static
+  void
+  permute(std::vector<value_type>& a_values,
+          const std::vector<size_type>& a_order,
+          size_type a_stride)
+  {
+    std::vector<value_type> values(a_values.size());
+    for (size_type n = 0; n < a_order.size(); ++n)
+    {
+      std::copy(a_values.begin() + a_stride * a_order[n],
+                a_values.begin() + a_stride * (a_order[n] + 1),
+                values.begin() + a_stride * n);
+    }
+    a_values.swap(values);
+  }
+
+  node_storage&
+  operator=(const node_storage& a_other);
+
+  size_type m_number_of_modes;
+  size_type m_size;
+  std::vector<value_type> m_positions;
+  std::vector<value_type> m_forces;
+  std::vector<value_type> m_modes;
+  size_type m_positions_version;
+  size_type m_forces_version;
+  size_type m_modes_version;
+}; // node_storage<T> class
+
 template <typename T>
 class node
 {
@@ -15,23 +195,20 @@ public:
   typedef const T& const_reference;
   typedef arma::Col<T> vector_type;
   typedef arma::Mat<T> matrix_type;
+  typedef node_storage<T> storage_type;
 
-  node(key_type a_key, size_type a_number_of_modes)
+  node(key_type a_key, storage_type& a_storage, size_type a_index)
     : m_key(a_key)
-    , m_position(6)
-    , m_force(6)
-    , m_modes(a_number_of_modes, 6)
+    , m_index(a_index)
+    , m_storage(&a_storage)
   {
-    m_position.zeros();
-    m_force.zeros();
-    m_modes.zeros();
+    // empty
   }
 
   node(const node& a_other)
     : m_key(a_other.m_key)
-    , m_position(a_other.m_position)
-    , m_force(a_other.m_force)
-    , m_modes(a_other.m_modes)
+    , m_index(a_other.m_index)
+    , m_storage(a_other.m_storage)
   {
     // empty
   }
@@ -45,9 +222,8 @@ public:
   operator=(const node& a_other)
   {
     m_key = a_other.m_key;
-    m_position = a_other.m_position;
-    m_force = a_other.m_force;
-    m_modes = a_other.m_modes;
+    m_index = a_other.m_index;
+    m_storage = a_other.m_storage;
     return *this;
   }
 
@@ -57,142 +233,201 @@ public:
     return m_key;
   }
 
-  const vector_type&
+  size_type
+  get_index() const
+  {
+    return m_index;
+  }
+
+  // The version of the positions of all of the nodes in the same storage;
+  // see node_storage::get_positions_version().
+
+  size_type
+  get_positions_version() const
+  {
+    return m_storage->get_positions_version();
+  }
+
+  // The vectors and matrices returned below are copies of the storage owned
+  // by the structure; changing them does not change the node.
+
+  vector_type
   get_position() const
   {
-    return m_position;
+    return vector_type(m_storage->get_position(m_index), 6);
   }
 
   const_reference
   get_position(size_type a_dof) const
   {
-    return m_position(a_dof);
+    return m_storage->get_position(m_index)[a_dof];
   }
 
-  const vector_type&
+  vector_type
   get_force() const
   {
-    return m_force;
+    return vector_type(m_storage->get_force(m_index), 6);
   }
 
   const_reference
   get_force(size_type a_dof) const
   {
-    return m_force(a_dof);
+    return m_storage->get_force(m_index)[a_dof];
   }
 
   const_reference
   get_mode(size_type a_mode, size_type a_dof) const
   {
-    return m_modes(a_mode, a_dof);
+    return m_storage->get_modes(m_index)[get_offset(a_mode, a_dof)];
   }
 
-  const matrix_type&
+  matrix_type
   get_modes() const
   {
-    return m_modes;
+    return matrix_type(m_storage->get_modes(m_index),
+                       m_storage->get_number_of_modes(), 6);
   }
 
   void
   set_position(const vector_type& a_position)
   {
-    m_position = a_position;
+    value_type* x = m_storage->get_position(m_index);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      x[dof] = a_position(dof);
+    }
+    m_storage->touch_positions();
   }
 
   void
   set_position(size_type a_dof, const_reference a_value)
   {
-    m_position(a_dof) = a_value;
+    m_storage->get_position(m_index)[a_dof] = a_value;
+    m_storage->touch_positions();
   }
 
   void
   set_force(const vector_type& a_force)
   {
-    m_force = a_force;
+    value_type* f = m_storage->get_force(m_index);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      f[dof] = a_force(dof);
+    }
+    m_storage->touch_forces();
   }
 
   void
   set_force(size_type a_dof, const_reference a_value)
   {
-    m_force(a_dof) = a_value;
+    m_storage->get_force(m_index)[a_dof] = a_value;
+    m_storage->touch_forces();
   }
 
   void
   set_mode(size_type a_mode, const vector_type& a_shape)
   {
-    m_modes.row(a_mode) = a_shape.t();
+    value_type* m = m_storage->get_modes(m_index);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      m[get_offset(a_mode, dof)] = a_shape(dof);
+    }
+    m_storage->touch_modes();
   }
 
   void
   set_mode(size_type a_mode, size_type a_dof, const_reference a_value)
   {
-    m_modes(a_mode, a_dof) = a_value;
+    m_storage->get_modes(m_index)[get_offset(a_mode, a_dof)] = a_value;
+    m_storage->touch_modes();
   }
 
   void
   clear_force()
   {
-    m_force.zeros();
+    value_type* f = m_storage->get_force(m_index);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      f[dof] = value_type(0);
+    }
+    m_storage->touch_forces();
   }
 
   void
   add_force(const vector_type& a_force)
   {
-    m_force += a_force;
+    value_type* f = m_storage->get_force(m_index);
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      f[dof] += a_force(dof);
+    }
+    m_storage->touch_forces();
   }
 
   void
   add_force(size_type a_dof, const_reference a_value)
   {
-    m_force(a_dof) += a_value;
+    m_storage->get_force(m_index)[a_dof] += a_value;
+    m_storage->touch_forces();
   }
 
   vector_type
   get_displaced_position(const vector_type& a_q) const
   {
-    return m_position + m_modes.t() * a_q;
+    return get_position() + modes().t() * a_q;
   }
 
   vector_type
   get_displacement(const vector_type& a_q) const
   {
-    return m_modes.t() * a_q;
+    return modes().t() * a_q;
   }
 
   value_type
   get_displacement(size_type a_dof, const vector_type& a_q) const
   {
-    return arma::dot(m_modes.col(a_dof), a_q);
+    return arma::dot(modes().col(a_dof), a_q);
   }
 
   vector_type
   get_velocity(const vector_type& a_dq) const
   {
-    return m_modes.t() * a_dq;
+    return modes().t() * a_dq;
   }
 
   value_type
   get_velocity(size_type a_dof, const vector_type& a_dq) const
   {
-    return arma::dot(m_modes.col(a_dof), a_dq);
+    return arma::dot(modes().col(a_dof), a_dq);
   }
 
   vector_type
   get_acceleration(const vector_type& a_ddq) const
   {
-    return m_modes.t() * a_ddq;
+    return modes().t() * a_ddq;
   }
 
   value_type
   get_acceleration(size_type a_dof, const vector_type& a_ddq) const
   {
-    return arma::dot(m_modes.col(a_dof), a_ddq);
+    return arma::dot(modes().col(a_dof), a_ddq);
   }
 
   vector_type
   get_generalized_force(const vector_type& a_active) const
   {
-    return m_modes * arma::diagmat(a_active) * m_force;
+    const matrix_type m = modes();
+    const value_type* f = m_storage->get_force(m_index);
+    vector_type result(m.n_rows);
+    result.zeros();
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      if (a_active(dof) != value_type(0))
+      {
+        result += m.col(dof) * f[dof];
+      }
+    }
+    return result;
   }
 private:
   node()
@@ -200,10 +435,22 @@ private:
     // empty
   }
 
+  size_type
+  get_offset(size_type a_mode, size_type a_dof) const
+  {
+    return a_dof * m_storage->get_number_of_modes() + a_mode;
+  }
+
+  matrix_type
+  modes() const
+  {
+    return matrix_type(m_storage->get_modes(m_index),
+                       m_storage->get_number_of_modes(), 6, false, true);
+  }
+
   key_type m_key;
-  vector_type m_position;
-  vector_type m_force;
-  matrix_type m_modes;
+  size_type m_index;
+  storage_type* m_storage;
 }; // node<T> class
 
 } // yamss namespace
@@ -0,0 +1,31 @@
+#ifndef YAMSS_ORDERING_HPP
+#define YAMSS_ORDERING_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace yamss {
+
+// The functions below compute node orderings that improve the locality of
+// per-element loops.  Each returns a permutation: entry i is the current
+// index of the node that should be moved to index i.
+
+// Order the nodes by the reverse Cuthill-McKee algorithm, where two nodes are
+// adjacent if they share an element.  The connectivity is given in
+// compressed sparse row form; see element_storage.  Vertex indices that are
+// not below a_number_of_nodes, such as unset vertices, are ignored.
+
+std::vector<size_t>
+reverse_cuthill_mckee(size_t a_number_of_nodes,
+                      const std::vector<size_t>& a_offsets,
+                      const std::vector<size_t>& a_vertices);
+
+// Order the nodes along a Morton (Z-order) curve through their bounding box.
+// a_coordinates holds the x, y and z coordinates of each node in turn.
+
+std::vector<size_t>
+morton_order(const std::vector<double>& a_coordinates);
+
+} // yamss namespace
+
+#endif // YAMSS_ORDERING_HPP
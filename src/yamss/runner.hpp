@@ -97,6 +97,12 @@ public:
     m_inspectors.push_back(a_inspector);
   }
 
+  void
+  remove_inspector(const inspector_pointer a_inspector)
+  {
+    m_inspectors.remove(a_inspector);
+  }
+
   void
   initialize(const path_type& a_output_path = path_type())
   {
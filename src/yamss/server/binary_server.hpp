@@ -0,0 +1,129 @@
+#ifndef YAMSS_SERVER_BINARY_SERVER_HPP
+#define YAMSS_SERVER_BINARY_SERVER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <zmq.h>
+#include "yamss/handler.hpp"
+
+namespace yamss {
+namespace server {
+
+// The binary server answers the interface calls with raw arrays sent as
+// ZeroMQ message frames, so large interface meshes are never serialized
+// element by element.  Arrays are sent straight from the matrices that hold
+// them, and received pressures are read in place.
+//
+// Requests and replies are multipart messages.  A request starts with the
+// name of the call, the job key, and a one-byte precision flag: 0 for 64-bit
+// and 1 for 32-bit floating point values.  Keys are 64-bit integers, and all
+// values are in the byte order of the host.
+//
+//   getInterface  request: load key
+//                 reply:   x, y, z, element types, element vertices
+//                          (types and vertices are 32-bit integers)
+//   getMovement   request: load key
+//                 reply:   displacements, velocities and accelerations, one
+//                          after another in a single frame
+//   setLoading    request: load key, pressures
+//                 reply:   nothing more
+//   exchange      request: subiterate flag (one byte), k load keys, m movement
+//                          keys, then k frames of pressures
+//                 reply:   m frames of movement, as for getMovement
+//
+// Every reply starts with a status frame, "ok" or "error"; an error is
+// followed by a frame that holds its message.
+
+class binary_server
+{
+public:
+  enum precision_type
+  {
+    FLOAT64,
+    FLOAT32
+  };
+
+  binary_server(void* a_context,
+                const std::string& a_endpoint,
+                int a_type,
+                const boost::shared_ptr<handler>& a_handler);
+
+  ~binary_server();
+
+  // Answer requests until the context is shut down.
+
+  void
+  serve();
+protected:
+  class frame;
+
+  typedef boost::shared_ptr<frame> frame_pointer;
+  typedef std::vector<frame_pointer> frames_type;
+  typedef boost::shared_ptr<void> owner_type;
+
+  bool
+  receive(frames_type& a_frames);
+
+  bool
+  send(const frames_type& a_frames);
+
+  void
+  dispatch(const frames_type& a_request, frames_type& a_reply);
+
+  void
+  get_interface(const frames_type& a_request, frames_type& a_reply);
+
+  void
+  get_movement(const frames_type& a_request, frames_type& a_reply);
+
+  void
+  set_loading(const frames_type& a_request, frames_type& a_reply);
+
+  void
+  exchange(const frames_type& a_request, frames_type& a_reply);
+
+  void
+  add_movement(handler::runner_type& a_runner,
+               std::int64_t a_loadKey,
+               precision_type a_precision,
+               frames_type& a_reply);
+
+  void
+  set_loading(handler::runner_type& a_runner,
+              std::int64_t a_loadKey,
+              precision_type a_precision,
+              const frame& a_pressures);
+
+  static
+  precision_type
+  get_precision(const frames_type& a_request);
+
+  // Return the number of pressures in a frame of the given precision.
+
+  static
+  size_t
+  get_number_of_pressures(precision_type a_precision, const frame& a_frame);
+
+  static
+  std::vector<std::int64_t>
+  get_keys(const frame& a_frame);
+
+  static
+  void
+  check_size(const frames_type& a_request, size_t a_size);
+private:
+  binary_server(const binary_server& a_other);
+
+  binary_server&
+  operator=(const binary_server& a_other);
+
+  void* m_socket;
+  boost::shared_ptr<handler> m_handler;
+}; // binary_server class
+
+} // server namespace
+} // yamss namespace
+
+#endif // YAMSS_SERVER_BINARY_SERVER_HPP
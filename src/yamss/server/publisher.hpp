@@ -0,0 +1,73 @@
+#ifndef YAMSS_SERVER_PUBLISHER_HPP
+#define YAMSS_SERVER_PUBLISHER_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
+#include <zmq.h>
+#include "yamss/handler.hpp"
+#include "yamss/inspector/inspector.hpp"
+
+namespace yamss {
+namespace server {
+
+// The publisher streams the state of selected jobs on a PUB socket, so that
+// monitoring clients never compete with the coupling client for the request
+// sockets.  Each message is a multipart message whose first frame is the job
+// key; subscribers filter on it.  The second frame names the contents:
+//
+//   state     step (64-bit integer), time, displacements, velocities,
+//             accelerations and forces of the modes
+//   movement  load key (64-bit integer), then the displacements, velocities
+//             and accelerations of the load one after another in one frame
+//
+// Values are 64-bit floating point numbers in the byte order of the host.
+
+class publisher : public boost::enable_shared_from_this<publisher>
+{
+public:
+  publisher(void* a_context, const std::string& a_endpoint);
+
+  ~publisher();
+
+  // Publish the state of a job, and the movement of the given loads, every
+  // a_stride steps.  A stride of zero stops publication for the job.
+
+  void
+  publish(handler& a_handler,
+          const JobKey& a_job,
+          std::int32_t a_stride,
+          const std::vector<std::int64_t>& a_loadKeys);
+
+  void
+  send(const std::vector<std::string>& a_frames);
+protected:
+  class publication;
+
+  // The runner of a job owns its publication; the publisher only watches
+  // it, so a released job takes its publication with it.
+
+  typedef boost::shared_ptr<inspector::inspector<double> > inspector_pointer;
+  typedef boost::weak_ptr<inspector::inspector<double> > inspector_reference;
+  typedef boost::unordered_map<JobKey, inspector_reference> publications_type;
+private:
+  publisher(const publisher& a_other);
+
+  publisher&
+  operator=(const publisher& a_other);
+
+  void* m_socket;
+  std::mutex m_socket_mutex;
+  std::mutex m_publications_mutex;
+  publications_type m_publications;
+}; // publisher class
+
+} // server namespace
+} // yamss namespace
+
+#endif // YAMSS_SERVER_PUBLISHER_HPP
@@ -1,8 +1,14 @@
 #ifndef YAMSS_SERVER_RUN_SERVER_HPP
 #define YAMSS_SERVER_RUN_SERVER_HPP
 
+#include <functional>
+#include <thread>
+#include <vector>
 #include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
 #include "yamss/clp.hpp"
+#include "yamss/server/binary_server.hpp"
 #include "yamss/server/server.hpp"
 
 namespace yamss {
@@ -1,7 +1,10 @@
 #ifndef YAMSS_SERVER_SERVER_HPP
 #define YAMSS_SERVER_SERVER_HPP
 
+#include <boost/shared_ptr.hpp>
 #include "yamss/handler.hpp"
+#include "yamss/server/publisher.hpp"
+#include "yamss/server/shared_transport.hpp"
 #include "yamss/server/yamss.hpp"
 
 namespace yamss {
@@ -15,6 +18,19 @@ public:
          int a_type,
          const boost::filesystem::path& a_directory);
 
+  // Servers that share a handler share its jobs; see run_server.  Without a
+  // publisher, calls to publish fail, and without a shared transport, so do
+  // calls to share.
+
+  server(void* a_context,
+         const std::string& a_endpoint,
+         int a_type,
+         const boost::shared_ptr<handler>& a_handler,
+         const boost::shared_ptr<publisher>& a_publisher =
+             boost::shared_ptr<publisher>(),
+         const boost::shared_ptr<shared_transport>& a_transport =
+             boost::shared_ptr<shared_transport>());
+
   // Job management
 
   JobKey
@@ -55,6 +71,21 @@ public:
   void
   setFinalTime(const JobKey& a_job, const double a_final_time);
 
+  // Monitoring
+
+  void
+  publish(const JobKey& a_job,
+          const std::int32_t a_stride,
+          const std::vector<std::int64_t>& a_loadKeys);
+
+  // Shared memory
+
+  std::string
+  share(const JobKey& a_job, const std::vector<std::int64_t>& a_loadKeys);
+
+  void
+  unshare(const JobKey& a_job);
+
   // Queries
 
   std::vector<bool>
@@ -96,8 +127,17 @@ public:
   setLoading(const JobKey& a_job,
              const std::int64_t a_loadKey,
              const InterfaceLoading& a_loading);
+
+  std::vector<InterfaceMovement>
+  exchange(const JobKey& a_job,
+           const std::vector<std::int64_t>& a_loadKeys,
+           const std::vector<InterfaceLoading>& a_loadings,
+           const bool a_subiterate,
+           const std::vector<std::int64_t>& a_movementKeys);
 private:
-  handler m_handler;
+  boost::shared_ptr<handler> m_handler;
+  boost::shared_ptr<publisher> m_publisher;
+  boost::shared_ptr<shared_transport> m_transport;
 }; // server class
 
 } // server namespace
@@ -0,0 +1,431 @@
+#ifndef YAMSS_SERVER_SHARED_MEMORY_HPP
+#define YAMSS_SERVER_SHARED_MEMORY_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace yamss {
+namespace server {
+
+// Coupling partners on the same host can exchange interface data through
+// POSIX shared memory instead of sockets.  A shared job has a control region
+// named /yamss-<job>, and each of its shared loads has a data region named
+// /yamss-<job>-<load>.  A data region holds a header, the pressures at the
+// nodes of the load, and then the displacements, velocities and
+// accelerations of the load, one after another.
+//
+// A coupling step is a handshake on two counters in the control region.  The
+// client writes the pressures, sets the subiterate flag, and increments
+// request.  The server applies the loads, steps the job, writes the
+// movement, sets the status, and makes reply equal to request.  A waiting
+// side spins briefly and then sleeps on a futex; where futexes are not
+// available, it polls.  When the server stops sharing the job, it sets
+// closed and fails a request that is still waiting, so that the client
+// does not wait for a reply that will never come.
+//
+// The counters are shared between processes, so they must be plain 32-bit
+// words that are lock-free.
+//
+// This header depends on nothing else in yamss, so that clients can include
+// it on its own.
+
+struct shared_control
+{
+  static const std::uint32_t magic_number = 0x79616d31;
+
+  std::uint32_t magic;
+  std::uint32_t number_of_loads;
+  std::atomic<std::uint32_t> request;
+  std::atomic<std::uint32_t> reply;
+  std::uint32_t subiterate;
+  std::int32_t status;
+  std::atomic<std::uint32_t> closed;
+  char message[228];
+}; // shared_control struct
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+              "The shared counters must be plain 32-bit words");
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "The shared counters must be lock-free");
+static_assert(sizeof(shared_control) == 256,
+              "The layout of the control region has changed");
+
+struct shared_load
+{
+  static const std::uint32_t magic_number = 0x79616d32;
+
+  std::uint32_t magic;
+  std::uint32_t reserved;
+  std::int64_t key;
+  std::uint64_t number_of_pressures;
+  std::uint64_t number_of_rows;
+  char padding[32];
+
+  static
+  size_t
+  get_region_size(size_t a_pressures, size_t a_rows)
+  {
+    return sizeof(shared_load) + (a_pressures + 3 * a_rows) * sizeof(double);
+  }
+
+  double*
+  get_pressures()
+  {
+    return reinterpret_cast<double*>(this + 1);
+  }
+
+  double*
+  get_movement()
+  {
+    return get_pressures() + number_of_pressures;
+  }
+}; // shared_load struct
+
+inline
+std::string
+get_shared_name(const std::string& a_job)
+{
+  return "/yamss-" + a_job;
+}
+
+inline
+std::string
+get_shared_name(const std::string& a_job, std::int64_t a_load)
+{
+  return "/yamss-" + a_job + "-" + std::to_string(a_load);
+}
+
+// A shared_region maps a named shared memory object.  The process that
+// creates the object also removes its name when the region is destroyed.
+// Creating a region whose name is already taken fails rather than taking
+// over an object that another process may still be using.
+
+class shared_region
+{
+public:
+  shared_region()
+    : m_name()
+    , m_address(0)
+    , m_size(0)
+    , m_owner(false)
+  {
+    // empty
+  }
+
+  ~shared_region()
+  {
+    close();
+  }
+
+  void
+  create(const std::string& a_name, size_t a_size)
+  {
+    close();
+    int fd = ::shm_open(a_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+      throw std::runtime_error("The region " + a_name + " already exists");
+    }
+    if (fd < 0)
+    {
+      throw std::runtime_error("Could not create the region " + a_name);
+    }
+    if (::ftruncate(fd, a_size) != 0)
+    {
+      ::close(fd);
+      ::shm_unlink(a_name.c_str());
+      throw std::runtime_error("Could not size the region " + a_name);
+    }
+    m_owner = true;
+    map(fd, a_name, a_size);
+  }
+
+  void
+  open(const std::string& a_name)
+  {
+    close();
+    int fd = ::shm_open(a_name.c_str(), O_RDWR, 0600);
+    struct stat status;
+    if (fd < 0 || ::fstat(fd, &status) != 0)
+    {
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      throw std::runtime_error("Could not open the region " + a_name);
+    }
+    m_owner = false;
+    map(fd, a_name, status.st_size);
+  }
+
+  void
+  close()
+  {
+    if (m_address)
+    {
+      ::munmap(m_address, m_size);
+      if (m_owner)
+      {
+        ::shm_unlink(m_name.c_str());
+      }
+    }
+    m_address = 0;
+    m_size = 0;
+    m_owner = false;
+  }
+
+  const std::string&
+  get_name() const
+  {
+    return m_name;
+  }
+
+  void*
+  get_address() const
+  {
+    return m_address;
+  }
+
+  size_t
+  get_size() const
+  {
+    return m_size;
+  }
+protected:
+  void
+  map(int a_fd, const std::string& a_name, size_t a_size)
+  {
+    void* address = ::mmap(0, a_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           a_fd, 0);
+    ::close(a_fd);
+    if (address == MAP_FAILED)
+    {
+      if (m_owner)
+      {
+        ::shm_unlink(a_name.c_str());
+      }
+      m_owner = false;
+      throw std::runtime_error("Could not map the region " + a_name);
+    }
+    m_name = a_name;
+    m_address = address;
+    m_size = a_size;
+  }
+private:
+  shared_region(const shared_region& a_other);
+
+  shared_region&
+  operator=(const shared_region& a_other);
+
+  std::string m_name;
+  void* m_address;
+  size_t m_size;
+  bool m_owner;
+}; // shared_region class
+
+// Wait until a_word no longer holds a_value, or until a_timeout has passed.
+// Return true if the value has changed.
+
+inline
+bool
+wait_for_change(std::atomic<std::uint32_t>& a_word,
+                std::uint32_t a_value,
+                std::chrono::microseconds a_timeout)
+{
+  // Most replies arrive within microseconds, which is far less than the cost
+  // of going to sleep, so spin for a little while first.
+  for (int n = 0; n < 4096; ++n)
+  {
+    if (a_word.load(std::memory_order_acquire) != a_value)
+    {
+      return true;
+    }
+  }
+
+  typedef std::chrono::steady_clock clock_type;
+  const clock_type::time_point deadline = clock_type::now() + a_timeout;
+  while (a_word.load(std::memory_order_acquire) == a_value)
+  {
+    clock_type::duration left = deadline - clock_type::now();
+    if (left <= clock_type::duration::zero())
+    {
+      return false;
+    }
+#ifdef __linux__
+    std::chrono::nanoseconds ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+    struct timespec timeout;
+    timeout.tv_sec = ns.count() / 1000000000;
+    timeout.tv_nsec = ns.count() % 1000000000;
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&a_word),
+              FUTEX_WAIT, a_value, &timeout, 0, 0);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+  }
+  return true;
+}
+
+inline
+void
+wake_all(std::atomic<std::uint32_t>& a_word)
+{
+#ifdef __linux__
+  ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&a_word),
+            FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+}
+
+// The client side of the shared memory transport.  The server must first
+// have been asked to share the job and its loads; see server::share.  An
+// exchange throws if the server stops sharing the job, or if no reply comes
+// within the timeout; the client cannot be used after that.
+
+class shared_client
+{
+public:
+  shared_client(const std::string& a_job,
+                const std::vector<std::int64_t>& a_loadKeys,
+                std::chrono::milliseconds a_timeout = std::chrono::seconds(30))
+    : m_control()
+    , m_loads(a_loadKeys.size())
+    , m_timeout(a_timeout)
+  {
+    m_control.open(get_shared_name(a_job));
+    if (get_control().magic != shared_control::magic_number)
+    {
+      throw std::runtime_error("The job " + a_job + " is not shared");
+    }
+    for (size_t n = 0; n < a_loadKeys.size(); ++n)
+    {
+      m_loads[n].open(get_shared_name(a_job, a_loadKeys[n]));
+      if (get_load(n).magic != shared_load::magic_number)
+      {
+        throw std::runtime_error("A load of the job " + a_job
+                                 + " is not shared");
+      }
+    }
+  }
+
+  size_t
+  get_number_of_loads() const
+  {
+    return m_loads.size();
+  }
+
+  size_t
+  get_number_of_pressures(size_t a_load) const
+  {
+    return get_load(a_load).number_of_pressures;
+  }
+
+  size_t
+  get_number_of_rows(size_t a_load) const
+  {
+    return get_load(a_load).number_of_rows;
+  }
+
+  double*
+  get_pressures(size_t a_load)
+  {
+    return get_load(a_load).get_pressures();
+  }
+
+  const double*
+  get_displacements(size_t a_load) const
+  {
+    return get_load(a_load).get_movement();
+  }
+
+  const double*
+  get_velocities(size_t a_load) const
+  {
+    return get_displacements(a_load) + get_number_of_rows(a_load);
+  }
+
+  const double*
+  get_accelerations(size_t a_load) const
+  {
+    return get_velocities(a_load) + get_number_of_rows(a_load);
+  }
+
+  // Hand the pressures to the server, and wait for it to step the job and
+  // write the movement.
+
+  void
+  exchange(bool a_subiterate = false)
+  {
+    typedef std::chrono::steady_clock clock_type;
+
+    shared_control& control = get_control();
+    if (control.closed.load(std::memory_order_acquire))
+    {
+      throw std::runtime_error("The job is no longer shared");
+    }
+    control.subiterate = a_subiterate ? 1 : 0;
+    const std::uint32_t request =
+        control.request.load(std::memory_order_relaxed) + 1;
+    control.request.store(request, std::memory_order_release);
+    wake_all(control.request);
+
+    // Wait in slices, so that a server that closes between the check above
+    // and the request is noticed too.
+    const clock_type::time_point deadline = clock_type::now() + m_timeout;
+    while (!wait_for_change(control.reply, request - 1,
+                            std::chrono::milliseconds(100)))
+    {
+      if (control.closed.load(std::memory_order_acquire))
+      {
+        throw std::runtime_error("The job is no longer shared");
+      }
+      if (clock_type::now() >= deadline)
+      {
+        throw std::runtime_error("The server did not reply in time");
+      }
+    }
+    if (control.status != 0)
+    {
+      throw std::runtime_error(std::string(control.message));
+    }
+  }
+protected:
+  shared_control&
+  get_control() const
+  {
+    return *static_cast<shared_control*>(m_control.get_address());
+  }
+
+  shared_load&
+  get_load(size_t a_load) const
+  {
+    return *static_cast<shared_load*>(m_loads[a_load].get_address());
+  }
+private:
+  shared_region m_control;
+  std::vector<shared_region> m_loads;
+  std::chrono::milliseconds m_timeout;
+}; // shared_client class
+
+} // server namespace
+} // yamss namespace
+
+#endif // YAMSS_SERVER_SHARED_MEMORY_HPP
@@ -0,0 +1,63 @@
+#ifndef YAMSS_SERVER_SHARED_TRANSPORT_HPP
+#define YAMSS_SERVER_SHARED_TRANSPORT_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include "yamss/handler.hpp"
+#include "yamss/server/shared_memory.hpp"
+
+namespace yamss {
+namespace server {
+
+// The shared transport serves jobs to coupling partners on the same host
+// through the shared memory regions described in shared_memory.hpp.  Each
+// shared job has a thread of its own, which waits for the client, applies
+// the pressures, steps the job and writes the movement where the client
+// reads it.  Nothing is copied through a socket, and the thread holds the
+// lock of the job only while it steps it, so the job can still be queried
+// through the other servers.
+
+class shared_transport
+{
+public:
+  shared_transport();
+
+  ~shared_transport();
+
+  // Share a job and the given interface loads, and return the name of the
+  // control region.  Sharing a job again replaces its regions.
+
+  std::string
+  share(const boost::shared_ptr<handler>& a_handler,
+        const JobKey& a_job,
+        const std::vector<std::int64_t>& a_loadKeys);
+
+  // Stop sharing a job and remove its regions.  A client that is waiting
+  // for a reply is told that the job is no longer shared.  Releasing a job
+  // through the server unshares it as well.
+
+  void
+  unshare(const JobKey& a_job);
+protected:
+  class channel;
+
+  typedef boost::shared_ptr<channel> channel_pointer;
+  typedef boost::unordered_map<JobKey, channel_pointer> channels_type;
+private:
+  shared_transport(const shared_transport& a_other);
+
+  shared_transport&
+  operator=(const shared_transport& a_other);
+
+  std::mutex m_channels_mutex;
+  channels_type m_channels;
+}; // shared_transport class
+
+} // server namespace
+} // yamss namespace
+
+#endif // YAMSS_SERVER_SHARED_TRANSPORT_HPP
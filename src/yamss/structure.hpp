@@ -1,14 +1,24 @@
 #ifndef YAMSS_STRUCTURE_HPP
 #define YAMSS_STRUCTURE_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 #include <boost/format.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/unordered_map.hpp>
+#include "yamss/complex.hpp"
 #include "yamss/element.hpp"
 #include "yamss/load.hpp"
 #include "yamss/map_values.hpp"
 #include "yamss/node.hpp"
+#include "yamss/ordering.hpp"
 
 namespace yamss {
 
@@ -21,33 +31,99 @@ public:
   typedef size_t size_type;
   typedef const T& const_reference;
   typedef node<T> node_type;
-  typedef map_values_iterator<key_type, node_type> node_iterator;
-  typedef map_values_iterator<key_type, const node_type> const_node_iterator;
+  typedef typename std::vector<node_type>::iterator node_iterator;
+  typedef typename std::vector<node_type>::const_iterator const_node_iterator;
   typedef element element_type;
-  typedef map_values_iterator<key_type, element_type> element_iterator;
-  typedef map_values_iterator<key_type, const element_type> const_element_iterator;
+  typedef element_storage element_storage_type;
+  typedef typename std::vector<element_type>::iterator element_iterator;
+  typedef typename std::vector<element_type>::const_iterator
+      const_element_iterator;
   typedef load<T> load_type;
   typedef map_values_iterator<key_type, load_type> load_iterator;
   typedef map_values_iterator<key_type, const load_type> const_load_iterator;
   typedef arma::Col<T> vector_type;
+  typedef arma::Mat<T> matrix_type;
+  typedef arma::SpMat<T> sparse_matrix_type;
+
+  static const size_type max_incremental_updates = 1000;
+
+  enum ordering_type
+  {
+    INPUT_ORDER,
+    REVERSE_CUTHILL_MCKEE,
+    MORTON
+  };
 
   structure(size_type a_number_of_modes)
     : m_number_of_modes(a_number_of_modes)
     , m_active_dofs(6)
+    , m_storage(a_number_of_modes)
+    , m_element_storage(m_node_keys, m_node_indices)
+    , m_generalized_force(a_number_of_modes)
+    , m_number_of_threads(1)
+    , m_loads_valid(false)
+    , m_forces_current(false)
+    , m_generalized_force_valid(false)
+    , m_separable_current(false)
+    , m_incremental_updates(0)
+    , m_loads_positions_version(0)
+    , m_loads_modes_version(0)
+    , m_forces_version(0)
+    , m_operators_positions_version(0)
+    , m_operators_modes_version(0)
+    , m_operators_elements_version(0)
+    , m_geometry_version(0)
+    , m_geometry_elements_version(0)
+    , m_geometry_valid(false)
+    , m_pool_generation(0)
+    , m_pool_pending(0)
+    , m_pool_stop(false)
   {
     m_active_dofs.ones();
   }
 
+  ~structure()
+  {
+    stop_workers();
+  }
+
+  size_type
+  get_number_of_threads() const
+  {
+    return m_number_of_threads;
+  }
+
+  // Set the number of threads used by apply_loads().  Zero selects one
+  // thread per hardware core.  The calling thread takes the first block of
+  // nodes, and the others are taken by workers that are started here and
+  // wait between steps.
+
+  void
+  set_number_of_threads(size_type a_number_of_threads)
+  {
+    if (a_number_of_threads == 0)
+    {
+      a_number_of_threads = std::thread::hardware_concurrency();
+    }
+    m_number_of_threads = std::max<size_type>(a_number_of_threads, 1);
+    start_workers();
+    invalidate_loads();
+  }
+
   void
   activate_dof(size_type a_dof)
   {
     m_active_dofs(a_dof) = 1.0;
+    invalidate_loads();
+    invalidate_load_operators();
   }
 
   void
   deactivate_dof(size_type a_dof)
   {
     m_active_dofs(a_dof) = 0.0;
+    invalidate_loads();
+    invalidate_load_operators();
   }
 
   bool
@@ -81,16 +157,23 @@ public:
     return result;
   }
 
-  node_type&
+  // Nodes and elements are returned as views by value.  A view stays valid
+  // as further nodes and elements are added, whereas a reference into the
+  // structure would not.
+
+  node_type
   add_node(key_type a_key)
   {
-    typedef typename nodes_type::iterator iterator;
+    typedef typename indices_type::iterator iterator;
 
-    std::pair<iterator, bool> result = m_nodes.insert(std::make_pair(
-        a_key, node_type(a_key, m_number_of_modes)));
+    std::pair<iterator, bool> result = m_node_indices.insert(std::make_pair(
+        a_key, m_nodes.size()));
     if (result.second)
     {
-      return result.first->second;
+      m_nodes.push_back(node_type(a_key, m_storage, m_storage.add()));
+      m_node_keys.push_back(a_key);
+      invalidate_node_indices();
+      return m_nodes.back();
     }
     else
     {
@@ -102,10 +185,22 @@ public:
   node_type&
   get_node(key_type a_key)
   {
-    typedef typename nodes_type::iterator iterator;
+    return m_nodes[get_node_index(a_key)];
+  }
+
+  const node_type&
+  get_node(key_type a_key) const
+  {
+    return m_nodes[get_node_index(a_key)];
+  }
+
+  size_type
+  get_node_index(key_type a_key) const
+  {
+    typedef typename indices_type::const_iterator const_iterator;
 
-    iterator result = m_nodes.find(a_key);
-    if (result == m_nodes.end())
+    const_iterator result = m_node_indices.find(a_key);
+    if (result == m_node_indices.end())
     {
       boost::format fmt("Failed to find node %1% in the structure.");
       throw std::runtime_error(boost::str(fmt % a_key));
@@ -116,21 +211,74 @@ public:
     }
   }
 
-  const node_type&
-  get_node(key_type a_key) const
-  {
-    typedef typename nodes_type::const_iterator const_iterator;
+  // Renumber the nodes internally to improve the locality of per-element
+  // loops, then sort the elements by their lowest vertex index.  Node and
+  // element keys are unaffected, but node references and iterators obtained
+  // earlier refer to different nodes afterwards.
 
-    const_iterator result = m_nodes.find(a_key);
-    if (result == m_nodes.end())
+  void
+  reorder_nodes(ordering_type a_ordering)
+  {
+    std::vector<size_type> order;
+    if (a_ordering == REVERSE_CUTHILL_MCKEE)
     {
-      boost::format fmt("Failed to find node %1% in the structure.");
-      throw std::runtime_error(boost::str(fmt % a_key));
+      order = reverse_cuthill_mckee(m_nodes.size(),
+                                    m_element_storage.get_offsets(),
+                                    m_element_storage.get_vertices());
+    }
+    else if (a_ordering == MORTON)
+    {
+      const matrix_type positions = m_storage.get_positions();
+      std::vector<double> coordinates(3 * m_nodes.size());
+      for (size_type n = 0; n < m_nodes.size(); ++n)
+      {
+        for (size_type c = 0; c < 3; ++c)
+        {
+          coordinates[3 * n + c] = ::yamss::real(positions(c, n));
+        }
+      }
+      order = morton_order(coordinates);
     }
     else
     {
-      return result->second;
+      return;
+    }
+    reorder_nodes(order);
+  }
+
+  // Move the node at index a_order[i] to index i.
+
+  void
+  reorder_nodes(const std::vector<size_type>& a_order)
+  {
+    const size_type n_nodes = m_nodes.size();
+    std::vector<size_type> new_indices(n_nodes, n_nodes);
+    bool valid = a_order.size() == n_nodes;
+    for (size_type n = 0; valid && n < n_nodes; ++n)
+    {
+      valid = a_order[n] < n_nodes && new_indices[a_order[n]] == n_nodes;
+      if (valid)
+      {
+        new_indices[a_order[n]] = n;
+      }
+    }
+    if (!valid)
+    {
+      throw std::runtime_error("The node ordering is not a permutation.");
+    }
+
+    m_storage.permute(a_order);
+    std::vector<key_type> keys(n_nodes);
+    for (size_type n = 0; n < n_nodes; ++n)
+    {
+      keys[n] = m_node_keys[a_order[n]];
+      m_nodes[n] = node_type(keys[n], m_storage, n);
+      m_node_indices[keys[n]] = n;
     }
+    m_node_keys.swap(keys);
+    m_element_storage.renumber_nodes(new_indices);
+    reorder_elements();
+    invalidate_node_indices();
   }
 
   size_type
@@ -142,172 +290,239 @@ public:
   node_iterator
   begin_nodes()
   {
-    return node_iterator(m_nodes.begin());
+    return m_nodes.begin();
   }
 
   node_iterator
   end_nodes()
   {
-    return node_iterator(m_nodes.end());
+    return m_nodes.end();
   }
 
   const_node_iterator
   begin_nodes() const
   {
-    return const_node_iterator(m_nodes.begin());
+    return m_nodes.begin();
   }
 
   const_node_iterator
   end_nodes() const
   {
-    return const_node_iterator(m_nodes.end());
+    return m_nodes.end();
   }
 
-  element_type&
-  add_element(key_type a_key, element::shape_type a_shape)
+  // The node data are stored column by column in dense index order: a 6 x N
+  // matrix of positions, a 6 x N matrix of forces, and an m x 6N matrix of
+  // mode shapes.  The views are invalidated by add_node().
+
+  const matrix_type
+  get_positions() const
   {
-    typedef typename elements_type::iterator iterator;
+    return m_storage.get_positions();
+  }
 
-    std::pair<iterator, bool> result = m_elements.insert(std::make_pair(
-        a_key, element_type(a_key, a_shape)));
-    if (result.second)
-    {
-      return result.first->second;
-    }
-    else
-    {
-      boost::format fmt("Failed to add element %1% to the structure.");
-      throw std::runtime_error(boost::str(fmt % a_key));
-    }
+  const matrix_type
+  get_forces() const
+  {
+    return m_storage.get_forces();
+  }
+
+  const matrix_type
+  get_modes() const
+  {
+    return m_storage.get_modes();
+  }
+
+  // The vertices of the new element must all be set before the geometry or
+  // the loads of the structure are used.
+
+  element_type
+  add_element(key_type a_key, element::shape_type a_shape)
+  {
+    const size_type index = m_element_storage.add(a_key, a_shape);
+    m_element_views.push_back(element_type(m_element_storage, index));
+    return m_element_views.back();
   }
 
   element_type&
   get_element(key_type a_key)
   {
-    typedef typename elements_type::iterator iterator;
+    return m_element_views[get_element_index(a_key)];
+  }
 
-    iterator result = m_elements.find(a_key);
-    if (result == m_elements.end())
+  size_type
+  get_element_index(key_type a_key) const
+  {
+    size_type index;
+    if (!m_element_storage.find(a_key, index))
     {
       boost::format fmt("Failed to find element %1% in the structure.");
       throw std::runtime_error(boost::str(fmt % a_key));
     }
-    else
-    {
-      return result->second;
-    }
+    return index;
   }
 
-  vector_type
-  get_element_normal(const element_type& a_element)
+  key_type
+  get_element_key(size_type a_index) const
   {
-    auto n_vertices = a_element.get_size();
-    vector_type normal = {0.0, 0.0, 1.0};
+    return m_element_storage.get_key(a_index);
+  }
 
-    if (n_vertices > 2)
-    {
-      const auto& node_0 = get_node(a_element.get_vertex(0));
-      const auto& node_1 = get_node(a_element.get_vertex(1));
-      const auto& node_n = get_node(a_element.get_vertex(n_vertices - 1));
-      const auto& x_0 = node_0.get_position();
-      const auto& x_1 = node_1.get_position();
-      const auto& x_n = node_n.get_position();
-      auto v_0 = x_0.head(3);
-      auto v_1 = x_1.head(3);
-      auto v_n = x_n.head(3);
+  // The connectivity of all of the elements, in compressed sparse row form
+  // over dense node indices, for sequential scans.  Element e is the one
+  // with index e; see get_element_index().
 
-      normal = ::arma::normalise(::arma::cross(v_1 - v_0, v_n - v_0));
-    }
+  const element_storage_type&
+  get_element_storage() const
+  {
+    return m_element_storage;
+  }
 
-    return normal;
+  // The areas, unit normals and centroids of the elements are computed
+  // together and cached until a node position or the connectivity of the
+  // elements changes.  Column (or entry) i belongs to the element with
+  // index i; see get_element_index().  Elements with fewer than three
+  // vertices have no area and a normal along the z axis.
+
+  const vector_type&
+  get_element_areas() const
+  {
+    update_element_geometry();
+    return m_element_areas;
   }
 
-  vector_type
-  get_element_normal(key_type a_key)
+  const matrix_type&
+  get_element_normals() const
   {
-    return get_element_normal(get_element(a_key));
+    update_element_geometry();
+    return m_element_normals;
   }
 
-  value_type
-  get_element_area(const element_type& a_element)
+  const matrix_type&
+  get_element_centroids() const
   {
-    auto n_vertices = a_element.get_size();
-    auto area = 0.0;
+    update_element_geometry();
+    return m_element_centroids;
+  }
 
-    if (n_vertices > 2)
-    {
-      vector_type v_a;
-      vector_type v_b;
-      vector_type summed = ::arma::zeros<vector_type>(3);
-      auto normal = get_element_normal(a_element);
+  vector_type
+  get_element_normal(const element_type& a_element) const
+  {
+    return get_element_normals().col(get_element_index(a_element.get_key()));
+  }
 
-      v_b = get_node(a_element.get_vertex(0)).get_position().head(3);
-      for (auto n = 1; n < n_vertices; ++n)
-      {
-        v_a = v_b;
-        v_b = get_node(a_element.get_vertex(n)).get_position().head(3);
-        summed += ::arma::cross(v_a, v_b);
-      }
-      v_a = v_b;
-      v_b = get_node(a_element.get_vertex(0)).get_position().head(3);
-      summed += ::arma::cross(v_a, v_b);
-      area = 0.5 * ::arma::dot(normal, summed);
-    }
+  vector_type
+  get_element_normal(key_type a_key) const
+  {
+    return get_element_normals().col(get_element_index(a_key));
+  }
 
-    return area;
+  value_type
+  get_element_area(const element_type& a_element) const
+  {
+    return get_element_areas()(get_element_index(a_element.get_key()));
   }
 
   value_type
-  get_element_area(key_type a_key)
+  get_element_area(key_type a_key) const
+  {
+    return get_element_areas()(get_element_index(a_key));
+  }
+
+  vector_type
+  get_element_centroid(const element_type& a_element) const
   {
-    return get_element_area(get_element(a_key));
+    return get_element_centroids().col(get_element_index(a_element.get_key()));
+  }
+
+  vector_type
+  get_element_centroid(key_type a_key) const
+  {
+    return get_element_centroids().col(get_element_index(a_key));
   }
 
   const element_type&
   get_element(key_type a_key) const
   {
-    typedef typename elements_type::const_iterator const_iterator;
+    return m_element_views[get_element_index(a_key)];
+  }
+
+  size_type
+  get_number_of_elements() const
+  {
+    return m_element_views.size();
+  }
+
+  // Return the operator that maps nodal pressures on a load to nodal
+  // forces; see load::get_pressure_operator().  The pressure on each
+  // element is the average of the pressures at its vertices, and the
+  // resulting force, along the element normal, is shared equally between
+  // its vertices.  The operator is built on first use.
 
-    const_iterator result = m_elements.find(a_key);
-    if (result == m_elements.end())
+  const sparse_matrix_type&
+  get_pressure_operator(key_type a_load)
+  {
+    load_type& load_ = get_load(a_load);
+    refresh_load_operators();
+    if (!load_.has_pressure_operator())
     {
-      boost::format fmt("Failed to find element %1% in the structure.");
-      throw std::runtime_error(boost::str(fmt % a_key));
+      build_pressure_operator(load_);
     }
-    else
+    return load_.get_pressure_operator();
+  }
+
+  // Return the mode shapes of the active degrees of freedom of the nodes of
+  // a load; see load::get_modes().  The matrix is built on first use.
+
+  const matrix_type&
+  get_load_modes(key_type a_load)
+  {
+    load_type& load_ = get_load(a_load);
+    refresh_load_operators();
+    if (!load_.has_modes())
     {
-      return result->second;
+      build_load_modes(load_);
     }
+    return load_.get_modes();
   }
 
-  size_type
-  get_number_of_elements() const
+  // The pressure operators and mode matrices of the loads are cached.  They
+  // are discarded automatically when nodes, elements, active degrees of
+  // freedom, node positions or mode shapes change.
+
+  void
+  invalidate_load_operators()
   {
-    return m_elements.size();
+    typename loads_type::iterator load_iter;
+    for (load_iter = m_loads.begin(); load_iter != m_loads.end(); ++load_iter)
+    {
+      load_iter->second.invalidate_pressure_operator();
+      load_iter->second.invalidate_modes();
+    }
   }
 
   element_iterator
   begin_elements()
   {
-    return element_iterator(m_elements.begin());
+    return m_element_views.begin();
   }
 
   element_iterator
   end_elements()
   {
-    return element_iterator(m_elements.end());
+    return m_element_views.end();
   }
 
   const_element_iterator
   begin_elements() const
   {
-    return const_element_iterator(m_elements.begin());
+    return m_element_views.begin();
   }
 
   const_element_iterator
   end_elements() const
   {
-    return const_element_iterator(m_elements.end());
+    return m_element_views.end();
   }
 
   template <typename Fn>
@@ -320,6 +535,7 @@ public:
         a_key, load_type(a_key, a_function)));
     if (result.second)
     {
+      invalidate_loads();
       return result.first->second;
     }
     else
@@ -390,71 +606,859 @@ public:
   void
   clear_loads()
   {
-    typedef typename nodes_type::iterator iterator;
-
-    iterator node_iterator = m_nodes.begin();
-    while (node_iterator != m_nodes.end())
-    {
-      node_iterator->second.clear_force();
-      ++node_iterator;
-    }
+    m_storage.clear_forces();
+    m_forces_current = false;
+    m_generalized_force_valid = false;
   }
 
+  // Each load is only evaluated again when the time or the version of its
+  // evaluator differs from the last evaluation; if nothing has changed, the
+  // nodal and generalized forces are left as they are.  When only some of
+  // the loads have changed, the difference between their old and new nodal
+  // forces is added to the nodal forces and projected onto the cached
+  // generalized force, skipping the nodes whose forces did not change.  To
+  // bound round-off, everything is summed from scratch now and then.
+  //
+  // Separable loads are never evaluated again; their precomputed shapes are
+  // scaled by the current value of their time function and added to the
+  // nodal forces.  On an incremental update only the change in the scale is
+  // added, and the precomputed modal projection carries the same change over
+  // to the generalized force.
+
   void
   apply_loads(const_reference a_time)
   {
-    typename load_type::const_iterator key_iter;
-    typename loads_type::const_iterator load_iter;
-    typename nodes_type::iterator node_iter;
+    prepare_loads();
+    refresh_forces();
+    if (!mark_stale_loads(a_time))
+    {
+      return;
+    }
 
-    clear_loads();
-    for (load_iter = m_loads.begin(); load_iter != m_loads.end(); ++load_iter)
+    const bool separable_changed = !m_separable_current
+                                || m_separable_time != a_time;
+    const bool incremental = m_forces_current
+                          && m_generalized_force_valid
+                          && m_incremental_updates < max_incremental_updates;
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
     {
-      const load_type& load_ = load_iter->second;
-      for (key_iter = load_.begin_nodes();
-           key_iter != load_.end_nodes();
-           ++key_iter)
+      if (m_load_stale[l])
       {
-        node_iter = m_nodes.find(*key_iter);
-        if (node_iter != m_nodes.end())
+        m_load_forces[l].swap(m_load_previous[l]);
+        const size_type n_nodes = m_load_pointers[l]->get_node_indices().size();
+        if (m_load_forces[l].n_cols != n_nodes)
         {
-          node_type& node_ = node_iter->second;
-          node_.add_force(load_.apply(a_time, node_));
+          m_load_forces[l].set_size(6, n_nodes);
         }
       }
     }
+
+    m_forces_current = false;
+    m_generalized_force_valid = false;
+    if (!incremental)
+    {
+      m_storage.clear_forces();
+    }
+    evaluate_loads(a_time);
+    if (incremental)
+    {
+      update_loads();
+      if (separable_changed)
+      {
+        apply_separable_loads(a_time, true);
+      }
+      m_generalized_force_valid = true;
+      ++m_incremental_updates;
+    }
+    else
+    {
+      sum_loads();
+      apply_separable_loads(a_time, false);
+      m_incremental_updates = 0;
+    }
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
+    {
+      if (m_load_stale[l])
+      {
+        m_load_times[l] = a_time;
+        m_load_versions[l] = m_load_pointers[l]->get_version();
+        m_load_stale[l] = 0;
+      }
+    }
+    m_forces_current = true;
   }
 
-  vector_type
+  // The shapes and modal projections of separable loads are computed once
+  // and reused, as are the results of every other load.  Call this after
+  // changing node positions or mode shapes through node references.
+
+  void
+  invalidate_loads()
+  {
+    m_loads_valid = false;
+    m_forces_current = false;
+    m_generalized_force_valid = false;
+  }
+
+  const vector_type&
   get_generalized_force()
   {
-    typedef typename nodes_type::const_iterator const_iterator;
+    refresh_forces();
+    if (m_generalized_force_valid)
+    {
+      return m_generalized_force;
+    }
 
-    vector_type f(m_number_of_modes);
-    f.zeros();
-    const_iterator node_iterator = m_nodes.begin();
-    while (node_iterator != m_nodes.end())
+    // The mode matrix already has one column per nodal degree of freedom in
+    // the same order as the forces, so the generalized force is one
+    // matrix-vector product.  Inactive degrees of freedom are masked out of
+    // a copy of the forces.
+    const size_type size = 6 * m_nodes.size();
+    const matrix_type modes = m_storage.get_modes();
+    value_type* forces = m_storage.get_force(0);
+    for (size_type dof = 0; dof < 6; ++dof)
     {
-      f += node_iterator->second.get_generalized_force(m_active_dofs);
-      ++node_iterator;
+      if (m_active_dofs(dof) == value_type(0))
+      {
+        m_masked_force = m_storage.get_forces();
+        for (size_type n = dof; n < 6; ++n)
+        {
+          if (m_active_dofs(n) == value_type(0))
+          {
+            m_masked_force.row(n).zeros();
+          }
+        }
+        forces = m_masked_force.memptr();
+        break;
+      }
     }
-    return f;
+    const vector_type f(forces, size, false, true);
+    m_generalized_force = modes * f;
+    m_generalized_force_valid = true;
+    return m_generalized_force;
   }
 private:
-  typedef boost::unordered_map<key_type, node_type> nodes_type;
+  typedef std::vector<node_type> nodes_type;
+  typedef boost::unordered_map<key_type, size_type> indices_type;
+  typedef node_storage<T> storage_type;
   typedef boost::unordered_map<key_type, load_type> loads_type;
-  typedef boost::unordered_map<key_type, element_type> elements_type;
+  typedef std::vector<load_type*> load_pointers_type;
 
   structure()
   {
     // empty
   }
 
+  void
+  resolve_node_indices(load_type& a_load) const
+  {
+    // Node keys that are not part of the structure get no index, so the
+    // load applies no force to them.
+    typename load_type::indices_type indices;
+    typename load_type::const_iterator key_iter;
+    typename indices_type::const_iterator index_iter;
+
+    indices.reserve(a_load.get_number_of_nodes());
+    for (key_iter = a_load.begin_nodes();
+         key_iter != a_load.end_nodes();
+         ++key_iter)
+    {
+      index_iter = m_node_indices.find(*key_iter);
+      if (index_iter != m_node_indices.end())
+      {
+        indices.push_back(index_iter->second);
+      }
+    }
+    a_load.set_node_indices(indices);
+  }
+
+  // Forces set through a node bypass the bookkeeping of the loads, so the
+  // nodal and generalized forces derived from the loads are no longer
+  // current once the forces version moves.
+
+  void
+  refresh_forces()
+  {
+    if (m_forces_version != m_storage.get_forces_version())
+    {
+      m_forces_current = false;
+      m_generalized_force_valid = false;
+      m_forces_version = m_storage.get_forces_version();
+    }
+  }
+
+  void
+  prepare_loads()
+  {
+    if (!m_loads_valid || !loads_are_current())
+    {
+      rebuild_loads();
+    }
+  }
+
+  bool
+  loads_are_current() const
+  {
+    if (m_loads_positions_version != m_storage.get_positions_version()
+        || m_loads_modes_version != m_storage.get_modes_version())
+    {
+      return false;
+    }
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
+    {
+      const load_type& load_ = *m_load_pointers[l];
+      if (!load_.has_node_indices() || load_.is_separable())
+      {
+        return false;
+      }
+    }
+    for (size_type l = 0; l < m_separable_pointers.size(); ++l)
+    {
+      const load_type& load_ = *m_separable_pointers[l];
+      if (!load_.has_node_indices() || !load_.is_separable()
+          || load_.get_version() != m_separable_versions[l])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void
+  rebuild_loads()
+  {
+    typename loads_type::iterator load_iter;
+
+    m_load_pointers.clear();
+    m_separable_pointers.clear();
+    m_load_forces.resize(m_loads.size());
+    m_load_previous.resize(m_loads.size());
+    for (load_iter = m_loads.begin(); load_iter != m_loads.end(); ++load_iter)
+    {
+      load_type& load_ = load_iter->second;
+      if (!load_.has_node_indices())
+      {
+        resolve_node_indices(load_);
+      }
+      if (load_.is_separable())
+      {
+        m_separable_pointers.push_back(&load_);
+        continue;
+      }
+      load_.reserve_threads(m_number_of_threads);
+      const size_type n_nodes = load_.get_node_indices().size();
+      matrix_type& forces = m_load_forces[m_load_pointers.size()];
+      if (forces.n_cols != n_nodes)
+      {
+        forces.set_size(6, n_nodes);
+      }
+      m_load_pointers.push_back(&load_);
+    }
+    prepare_separable_loads();
+
+    const size_type n_loads = m_load_pointers.size();
+    m_load_stale.assign(n_loads, 1);
+    m_load_times.resize(n_loads);
+    m_load_versions.resize(n_loads);
+    m_separable_current = false;
+    m_forces_current = false;
+    m_generalized_force_valid = false;
+    m_loads_positions_version = m_storage.get_positions_version();
+    m_loads_modes_version = m_storage.get_modes_version();
+    m_loads_valid = true;
+  }
+
+  void
+  build_pressure_operator(load_type& a_load)
+  {
+    typedef typename load_type::const_iterator const_iterator;
+    typedef typename element_type::vector_type vertices_type;
+
+    boost::unordered_map<key_type, size_type> order;
+    size_type n_nodes = 0;
+    for (const_iterator p = a_load.begin_nodes(); p != a_load.end_nodes(); ++p)
+    {
+      order[*p] = n_nodes++;
+    }
+
+    std::vector<arma::uword> rows;
+    std::vector<arma::uword> columns;
+    std::vector<value_type> values;
+    const_iterator e;
+    for (e = a_load.begin_elements(); e != a_load.end_elements(); ++e)
+    {
+      const element_type& element_ = get_element(*e);
+      const vertices_type& vertices = element_.get_vertices();
+      const size_type n_vertices = vertices.size();
+      if (n_vertices < 3)
+      {
+        continue;
+      }
+      const value_type weight = get_element_area(element_)
+                              / (n_vertices * n_vertices);
+      const vector_type normal = get_element_normal(element_);
+      for (size_type a = 0; a < n_vertices; ++a)
+      {
+        const size_type row = 3 * order.at(vertices[a]);
+        for (size_type b = 0; b < n_vertices; ++b)
+        {
+          const size_type column = order.at(vertices[b]);
+          for (size_type c = 0; c < 3; ++c)
+          {
+            rows.push_back(row + c);
+            columns.push_back(column);
+            values.push_back(weight * normal(c));
+          }
+        }
+      }
+    }
+
+    arma::umat locations(2, values.size());
+    for (size_type k = 0; k < values.size(); ++k)
+    {
+      locations(0, k) = rows[k];
+      locations(1, k) = columns[k];
+    }
+    const vector_type entries(values);
+    a_load.set_pressure_operator(sparse_matrix_type(true, locations, entries,
+                                                    3 * n_nodes, n_nodes));
+  }
+
+  void
+  refresh_load_operators()
+  {
+    if (m_operators_positions_version != m_storage.get_positions_version()
+        || m_operators_modes_version != m_storage.get_modes_version()
+        || m_operators_elements_version != m_element_storage.get_version())
+    {
+      invalidate_load_operators();
+      m_operators_positions_version = m_storage.get_positions_version();
+      m_operators_modes_version = m_storage.get_modes_version();
+      m_operators_elements_version = m_element_storage.get_version();
+    }
+  }
+
+  void
+  build_load_modes(load_type& a_load)
+  {
+    typedef typename load_type::const_iterator const_iterator;
+
+    const matrix_type modes = m_storage.get_modes();
+    const size_type n_nodes = a_load.get_number_of_nodes();
+    matrix_type shapes(m_number_of_modes,
+                       get_number_of_active_dofs() * n_nodes);
+    size_type column = 0;
+    for (size_type dof = 0; dof < 6; ++dof)
+    {
+      if (!is_active(dof))
+      {
+        continue;
+      }
+      const_iterator p;
+      for (p = a_load.begin_nodes(); p != a_load.end_nodes(); ++p)
+      {
+        shapes.col(column++) = modes.col(6 * get_node_index(*p) + dof);
+      }
+    }
+    a_load.set_modes(shapes.t());
+  }
+
+  void
+  reorder_elements()
+  {
+    const std::vector<size_type>& offsets = m_element_storage.get_offsets();
+    const std::vector<size_type>& vertices = m_element_storage.get_vertices();
+    const size_type n_elements = m_element_storage.get_size();
+    std::vector<std::pair<size_type, size_type> > lowest(n_elements);
+    for (size_type e = 0; e < n_elements; ++e)
+    {
+      lowest[e].first = m_nodes.size();
+      lowest[e].second = e;
+      for (size_type v = offsets[e]; v < offsets[e + 1]; ++v)
+      {
+        lowest[e].first = std::min(lowest[e].first, vertices[v]);
+      }
+    }
+    std::sort(lowest.begin(), lowest.end());
+    std::vector<size_type> order(n_elements);
+    for (size_type e = 0; e < n_elements; ++e)
+    {
+      order[e] = lowest[e].second;
+    }
+    m_element_storage.permute(order);
+  }
+
+  void
+  update_element_geometry() const
+  {
+    if (m_geometry_valid
+        && m_geometry_version == m_storage.get_positions_version()
+        && m_geometry_elements_version == m_element_storage.get_version())
+    {
+      return;
+    }
+
+    const std::vector<size_type>& offsets = m_element_storage.get_offsets();
+    const std::vector<size_type>& vertices = m_element_storage.get_vertices();
+    const matrix_type positions = m_storage.get_positions();
+    const size_type n_elements = m_element_storage.get_size();
+    m_element_areas.zeros(n_elements);
+    m_element_normals.zeros(3, n_elements);
+    m_element_centroids.zeros(3, n_elements);
+    for (size_type e = 0; e < n_elements; ++e)
+    {
+      const size_type* vertex = vertices.data() + offsets[e];
+      const size_type n_vertices = offsets[e + 1] - offsets[e];
+      if (std::find(vertex, vertex + n_vertices,
+                    element_storage_type::no_vertex) != vertex + n_vertices)
+      {
+        boost::format fmt("Element %1% has a vertex that has not been set.");
+        throw std::runtime_error(
+            boost::str(fmt % m_element_storage.get_key(e)));
+      }
+      value_type* normal = m_element_normals.colptr(e);
+      value_type* centroid = m_element_centroids.colptr(e);
+      normal[2] = value_type(1);
+
+      for (size_type v = 0; v < n_vertices; ++v)
+      {
+        const value_type* x = positions.colptr(vertex[v]);
+        for (size_type c = 0; c < 3; ++c)
+        {
+          centroid[c] += x[c] / value_type(n_vertices);
+        }
+      }
+      if (n_vertices < 3)
+      {
+        continue;
+      }
+
+      const value_type* x_0 = positions.colptr(vertex[0]);
+      const value_type* x_1 = positions.colptr(vertex[1]);
+      const value_type* x_n = positions.colptr(vertex[n_vertices - 1]);
+      value_type u[3];
+      value_type w[3];
+      for (size_type c = 0; c < 3; ++c)
+      {
+        u[c] = x_1[c] - x_0[c];
+        w[c] = x_n[c] - x_0[c];
+      }
+      cross(u, w, normal);
+      const value_type length = std::sqrt(normal[0] * normal[0]
+                                        + normal[1] * normal[1]
+                                        + normal[2] * normal[2]);
+      if (length != value_type(0))
+      {
+        for (size_type c = 0; c < 3; ++c)
+        {
+          normal[c] /= length;
+        }
+      }
+
+      value_type summed[3] = {value_type(0), value_type(0), value_type(0)};
+      for (size_type v = 0; v < n_vertices; ++v)
+      {
+        const value_type* x_a = positions.colptr(vertex[v]);
+        const value_type* x_b = positions.colptr(
+            vertex[(v + 1) % n_vertices]);
+        value_type product[3];
+        cross(x_a, x_b, product);
+        for (size_type c = 0; c < 3; ++c)
+        {
+          summed[c] += product[c];
+        }
+      }
+      m_element_areas(e) = value_type(0.5) * (normal[0] * summed[0]
+                                             + normal[1] * summed[1]
+                                             + normal[2] * summed[2]);
+    }
+    m_geometry_version = m_storage.get_positions_version();
+    m_geometry_elements_version = m_element_storage.get_version();
+    m_geometry_valid = true;
+  }
+
+  static
+  void
+  cross(const value_type* a_u, const value_type* a_v, value_type* a_result)
+  {
+    a_result[0] = a_u[1] * a_v[2] - a_u[2] * a_v[1];
+    a_result[1] = a_u[2] * a_v[0] - a_u[0] * a_v[2];
+    a_result[2] = a_u[0] * a_v[1] - a_u[1] * a_v[0];
+  }
+
+  bool
+  mark_stale_loads(const_reference a_time)
+  {
+    bool stale = !m_forces_current;
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
+    {
+      const load_type& load_ = *m_load_pointers[l];
+      if (!m_load_stale[l]
+          && ((load_.is_time_dependent() && m_load_times[l] != a_time)
+              || m_load_versions[l] != load_.get_version()))
+      {
+        m_load_stale[l] = 1;
+      }
+      stale = stale || m_load_stale[l];
+    }
+    if (!m_separable_current || m_separable_time != a_time)
+    {
+      stale = true;
+    }
+    return stale;
+  }
+
+  void
+  prepare_separable_loads()
+  {
+    typedef typename load_type::indices_type load_indices_type;
+
+    const size_type n_loads = m_separable_pointers.size();
+    const matrix_type modes = m_storage.get_modes();
+    m_separable_shapes.resize(n_loads);
+    m_separable_projections.resize(n_loads);
+    m_separable_scales.resize(n_loads);
+    m_separable_versions.resize(n_loads);
+    for (size_type l = 0; l < n_loads; ++l)
+    {
+      const load_type& load_ = *m_separable_pointers[l];
+      m_separable_versions[l] = load_.get_version();
+      const load_indices_type& indices = load_.get_node_indices();
+      matrix_type& shape = m_separable_shapes[l];
+      vector_type& projection = m_separable_projections[l];
+      shape.set_size(6, indices.size());
+      load_.evaluate_shape(m_nodes, shape);
+      projection.zeros(m_number_of_modes);
+      for (size_type n = 0; n < indices.size(); ++n)
+      {
+        for (size_type dof = 0; dof < 6; ++dof)
+        {
+          if (m_active_dofs(dof) != value_type(0))
+          {
+            projection += shape(dof, n) * modes.col(6 * indices[n] + dof);
+          }
+        }
+      }
+    }
+  }
+
+  // Add the scaled shapes of the separable loads to the nodal forces.  The
+  // scales are only evaluated again when the time has changed.  With
+  // a_incremental set, the nodal forces already hold the shapes at the old
+  // scales, so only the differences are added, to the nodal forces as well
+  // as to the generalized force.
+
+  void
+  apply_separable_loads(const_reference a_time, bool a_incremental)
+  {
+    typedef typename load_type::indices_type load_indices_type;
+
+    const bool rescale = !m_separable_current || m_separable_time != a_time;
+    value_type* g = m_generalized_force.memptr();
+    for (size_type l = 0; l < m_separable_pointers.size(); ++l)
+    {
+      const load_type& load_ = *m_separable_pointers[l];
+      const value_type scale = rescale ? load_.get_scale(a_time)
+                                       : m_separable_scales[l];
+      const value_type delta = a_incremental ? scale - m_separable_scales[l]
+                                             : scale;
+      m_separable_scales[l] = scale;
+      if (delta == value_type(0))
+      {
+        continue;
+      }
+
+      const load_indices_type& indices = load_.get_node_indices();
+      const matrix_type& shape = m_separable_shapes[l];
+      for (size_type n = 0; n < indices.size(); ++n)
+      {
+        value_type* f = m_storage.get_force(indices[n]);
+        for (size_type dof = 0; dof < 6; ++dof)
+        {
+          f[dof] += delta * shape(dof, n);
+        }
+      }
+      if (a_incremental)
+      {
+        const value_type* projection = m_separable_projections[l].memptr();
+        for (size_type m = 0; m < m_number_of_modes; ++m)
+        {
+          g[m] += delta * projection[m];
+        }
+      }
+    }
+    m_separable_time = a_time;
+    m_separable_current = true;
+  }
+
+  // Each load is evaluated into a buffer of its own.  When several threads
+  // are used, the nodes of each load are split into contiguous blocks, one
+  // per thread.  Each step bumps the generation of the pool, which releases
+  // the waiting workers, and then waits until all of them are done.
+
+  void
+  evaluate_loads(const_reference a_time)
+  {
+    const size_type n_threads = m_number_of_threads;
+    if (n_threads == 1)
+    {
+      std::exception_ptr error;
+      evaluate_block(a_time, 0, error);
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_pool_mutex);
+      for (size_type thread = 0; thread < n_threads; ++thread)
+      {
+        m_pool_errors[thread] = std::exception_ptr();
+      }
+      m_pool_time = a_time;
+      m_pool_pending = n_threads - 1;
+      ++m_pool_generation;
+    }
+    m_pool_start.notify_all();
+    evaluate_block(a_time, 0, m_pool_errors[0]);
+    {
+      std::unique_lock<std::mutex> lock(m_pool_mutex);
+      while (m_pool_pending > 0)
+      {
+        m_pool_done.wait(lock);
+      }
+    }
+    for (size_type thread = 0; thread < n_threads; ++thread)
+    {
+      if (m_pool_errors[thread])
+      {
+        std::rethrow_exception(m_pool_errors[thread]);
+      }
+    }
+  }
+
+  void
+  start_workers()
+  {
+    stop_workers();
+    m_pool_errors.assign(m_number_of_threads, std::exception_ptr());
+    m_pool_stop = false;
+    for (size_type thread = 1; thread < m_number_of_threads; ++thread)
+    {
+      m_workers.push_back(std::thread(&structure::run_worker, this, thread,
+                                      m_pool_generation));
+    }
+  }
+
+  void
+  stop_workers()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_pool_mutex);
+      m_pool_stop = true;
+    }
+    m_pool_start.notify_all();
+    for (size_type n = 0; n < m_workers.size(); ++n)
+    {
+      m_workers[n].join();
+    }
+    m_workers.clear();
+  }
+
+  // A worker starts from the generation current when it was created, so it
+  // neither misses the next step nor repeats the last one.
+
+  void
+  run_worker(size_type a_thread, size_type a_generation)
+  {
+    size_type generation = a_generation;
+    for (;;)
+    {
+      value_type time;
+      {
+        std::unique_lock<std::mutex> lock(m_pool_mutex);
+        while (!m_pool_stop && m_pool_generation == generation)
+        {
+          m_pool_start.wait(lock);
+        }
+        if (m_pool_stop)
+        {
+          return;
+        }
+        generation = m_pool_generation;
+        time = m_pool_time;
+      }
+      evaluate_block(time, a_thread, m_pool_errors[a_thread]);
+      {
+        std::lock_guard<std::mutex> lock(m_pool_mutex);
+        if (--m_pool_pending == 0)
+        {
+          m_pool_done.notify_one();
+        }
+      }
+    }
+  }
+
+  void
+  evaluate_block(value_type a_time,
+                 size_type a_thread,
+                 std::exception_ptr& a_error)
+  {
+    try
+    {
+      for (size_type l = 0; l < m_load_pointers.size(); ++l)
+      {
+        if (!m_load_stale[l])
+        {
+          continue;
+        }
+        const load_type& load_ = *m_load_pointers[l];
+        const size_type size = load_.get_node_indices().size();
+        const size_type begin = size * a_thread / m_number_of_threads;
+        const size_type end = size * (a_thread + 1) / m_number_of_threads;
+        if (begin < end)
+        {
+          load_.evaluate(a_time, m_nodes, begin, end, a_thread,
+                         m_load_forces[l]);
+        }
+      }
+    }
+    catch (...)
+    {
+      a_error = std::current_exception();
+    }
+  }
+
+  // Add the change in the forces of the loads just evaluated to the nodes
+  // and to the generalized force.
+
+  void
+  update_loads()
+  {
+    typedef typename load_type::indices_type load_indices_type;
+
+    const matrix_type modes = m_storage.get_modes();
+    value_type* g = m_generalized_force.memptr();
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
+    {
+      if (!m_load_stale[l])
+      {
+        continue;
+      }
+      const load_indices_type& indices = m_load_pointers[l]->get_node_indices();
+      const matrix_type& current = m_load_forces[l];
+      const matrix_type& previous = m_load_previous[l];
+      for (size_type n = 0; n < indices.size(); ++n)
+      {
+        value_type* f = m_storage.get_force(indices[n]);
+        for (size_type dof = 0; dof < 6; ++dof)
+        {
+          const value_type delta = current(dof, n) - previous(dof, n);
+          if (delta == value_type(0))
+          {
+            continue;
+          }
+          f[dof] += delta;
+          if (m_active_dofs(dof) != value_type(0))
+          {
+            const value_type* phi = modes.colptr(6 * indices[n] + dof);
+            for (size_type m = 0; m < m_number_of_modes; ++m)
+            {
+              g[m] += delta * phi[m];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // The buffers are summed into the nodes serially, load by load and node by
+  // node, so the result does not depend on the number of threads.
+
+  void
+  sum_loads()
+  {
+    typedef typename load_type::indices_type load_indices_type;
+
+    for (size_type l = 0; l < m_load_pointers.size(); ++l)
+    {
+      const load_indices_type& indices = m_load_pointers[l]->get_node_indices();
+      const matrix_type& forces = m_load_forces[l];
+      for (size_type n = 0; n < indices.size(); ++n)
+      {
+        value_type* f = m_storage.get_force(indices[n]);
+        for (size_type dof = 0; dof < 6; ++dof)
+        {
+          f[dof] += forces(dof, n);
+        }
+      }
+    }
+  }
+
+  void
+  invalidate_node_indices()
+  {
+    typename loads_type::iterator load_iter;
+    invalidate_loads();
+    for (load_iter = m_loads.begin(); load_iter != m_loads.end(); ++load_iter)
+    {
+      load_iter->second.invalidate_node_indices();
+    }
+    invalidate_load_operators();
+  }
+
   size_type m_number_of_modes;
   vector_type m_active_dofs;
+  storage_type m_storage;
   nodes_type m_nodes;
+  std::vector<key_type> m_node_keys;
+  indices_type m_node_indices;
+  element_storage_type m_element_storage;
+  std::vector<element_type> m_element_views;
   loads_type m_loads;
-  elements_type m_elements;
+  vector_type m_generalized_force;
+  matrix_type m_masked_force;
+  size_type m_number_of_threads;
+  load_pointers_type m_load_pointers;
+  std::vector<matrix_type> m_load_forces;
+  load_pointers_type m_separable_pointers;
+  std::vector<matrix_type> m_separable_shapes;
+  std::vector<vector_type> m_separable_projections;
+  std::vector<value_type> m_separable_scales;
+  std::vector<matrix_type> m_load_previous;
+  std::vector<char> m_load_stale;
+  std::vector<value_type> m_load_times;
+  std::vector<size_type> m_load_versions;
+  std::vector<size_type> m_separable_versions;
+  value_type m_separable_time;
+  bool m_loads_valid;
+  bool m_forces_current;
+  bool m_generalized_force_valid;
+  bool m_separable_current;
+  size_type m_incremental_updates;
+  size_type m_loads_positions_version;
+  size_type m_loads_modes_version;
+  size_type m_forces_version;
+  size_type m_operators_positions_version;
+  size_type m_operators_modes_version;
+  size_type m_operators_elements_version;
+  mutable vector_type m_element_areas;
+  mutable matrix_type m_element_normals;
+  mutable matrix_type m_element_centroids;
+  mutable size_type m_geometry_version;
+  mutable size_type m_geometry_elements_version;
+  mutable bool m_geometry_valid;
+  std::vector<std::thread> m_workers;
+  std::vector<std::exception_ptr> m_pool_errors;
+  std::mutex m_pool_mutex;
+  std::condition_variable m_pool_start;
+  std::condition_variable m_pool_done;
+  size_type m_pool_generation;
+  size_type m_pool_pending;
+  value_type m_pool_time;
+  bool m_pool_stop;
 }; // structure<T> class
 
 } // yamss namespace
@@ -91,6 +91,13 @@ setLoading(const JobKey& a_job,
            const std::int64_t a_loadKey,
            const InterfaceLoading& a_loading) throw(YamssException);
 
+std::vector<InterfaceMovement>
+exchange(const JobKey& a_job,
+         const std::vector<std::int64_t>& a_loadKeys,
+         const std::vector<InterfaceLoading>& a_loadings,
+         const bool a_subiterate,
+         const std::vector<std::int64_t>& a_movementKeys) throw(YamssException);
+
 } // wrapper namespace
 } // yamss namespace
 
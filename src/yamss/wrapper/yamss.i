@@ -102,6 +102,13 @@ setLoading(const JobKey& a_job,
            const std::int64_t a_loadKey,
            const InterfaceLoading& a_loading) throw(YamssException);
 
+std::vector<InterfaceMovement>
+exchange(const JobKey& a_job,
+         const std::vector<std::int64_t>& a_loadKeys,
+         const std::vector<InterfaceLoading>& a_loadings,
+         const bool a_subiterate,
+         const std::vector<std::int64_t>& a_movementKeys) throw(YamssException);
+
 }
 }
 
@@ -110,6 +117,9 @@ namespace std {
 %template(BooleanVector) vector<bool>;
 %template(DoubleVector) vector<double>;
 %template(Int32Vector) vector<std::int32_t>;
+%template(Int64Vector) vector<std::int64_t>;
 %template(ElementTypeVector) vector<yamss::ElementType>;
+%template(InterfaceLoadingVector) vector<yamss::InterfaceLoading>;
+%template(InterfaceMovementVector) vector<yamss::InterfaceMovement>;
 
 }